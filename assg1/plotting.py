@@ -2,7 +2,7 @@ import subprocess
 import matplotlib.pyplot as plt
 
 
-subprocess.run(["mpicc","trapIntegral-hw.c", "-o", "out"], check=True)
+subprocess.run(["mpicc", "-O3", "-march=native", "-fopenmp", "trapIntegral-hw.c", "-o", "out", "-lm"], check=True)
 processor_count = [1,2,3,4]
 
 
@@ -0,0 +1,297 @@
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// integrals over the unit cube [0,1]^dims for dims up to MAX_DIMS, where trapezoid grids are out of the question
+// every rank runs threads x STREAMS_PER_THREAD streams, each stream is an independent estimate of the integral:
+//   qmc: the Sobol sequence with its own random digital shift (every coordinate XORed with a random 32 bit word)
+//   mc:  plain random points from a counter based generator
+// the streams are seeded from (seed, rank, thread, stream) only, so every stream's points are the same in every run
+// the ranks keep computing while a non-blocking MPI_Iallreduce combines everybody's statistics,
+// and all of them stop once the confidence interval is below the target; how many rounds that takes depends on
+// when the reduction completes, so the final estimate and point count can differ from run to run
+#define MAX_DIMS 20
+#define STREAMS_PER_THREAD 4
+#define BATCH 256    // points a stream evaluates at a time, the integrand runs over the whole batch
+#define ROUND 4096   // points per stream between two checks of the confidence interval
+#define Z95 1.96     // 95% confidence interval
+
+// Sobol direction numbers from Joe and Kuo (new-joe-kuo-6.21201): degree s, coefficients a and the initial m_1..m_s
+// of the primitive polynomial for dimensions 2..20, dimension 1 is the van der Corput sequence
+static const int sobol_s[MAX_DIMS] = {0, 1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 7};
+static const int sobol_a[MAX_DIMS] = {0, 0, 1, 1, 2, 1, 4, 2, 4, 7, 11, 13, 14, 1, 13, 16, 19, 22, 25, 1};
+static const int sobol_m[MAX_DIMS][7] = {
+    {0}, {1}, {1, 3}, {1, 3, 1}, {1, 1, 1}, {1, 1, 3, 3}, {1, 3, 5, 13}, {1, 1, 5, 5, 17}, {1, 1, 5, 5, 5},
+    {1, 1, 7, 11, 19}, {1, 1, 5, 1, 1}, {1, 1, 1, 3, 11}, {1, 3, 5, 5, 31}, {1, 3, 3, 9, 7, 49}, {1, 1, 1, 15, 21, 21},
+    {1, 3, 1, 13, 27, 49}, {1, 1, 1, 15, 7, 5}, {1, 3, 1, 15, 13, 25}, {1, 1, 5, 5, 19, 61}, {1, 3, 7, 11, 23, 15, 103}};
+
+uint32_t directions[MAX_DIMS][32];
+
+void init_directions(int dims) {
+    for (int j = 0; j < dims; j++) {
+        int s = sobol_s[j], a = sobol_a[j];
+        for (int k = 0; k < 32; k++) {
+            if (j == 0) {
+                directions[j][k] = 1u << (31 - k);
+            }
+            else if (k < s) {
+                directions[j][k] = (uint32_t)sobol_m[j][k] << (31 - k);
+            }
+            else {
+                uint32_t v = directions[j][k - s] ^ (directions[j][k - s] >> s);
+                for (int i = 1; i < s; i++) {
+                    if ((a >> (s - 1 - i)) & 1) {
+                        v ^= directions[j][k - i];
+                    }
+                }
+                directions[j][k] = v;
+            }
+        }
+    }
+}
+
+// splitmix64, also what every stream's seed and shifts come from
+uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// the integrands, each with its exact value so the actual error can be shown
+// x holds a batch dimension after dimension: x[j * BATCH + k] is coordinate j of point k
+typedef void (*batch_integrand_t)(const double* x, int dims, double* f);
+
+// Sobol's g-function, prod (|4 x_j - 2| + a_j) / (1 + a_j) with a_j = j, every dimension matters a little less
+void g_function(const double* x, int dims, double* f) {
+    for (int k = 0; k < BATCH; k++) f[k] = 1.0;
+    for (int j = 0; j < dims; j++) {
+        const double* xj = x + j * BATCH;
+        double a = j + 1;
+        for (int k = 0; k < BATCH; k++) {
+            f[k] *= (fabs(4.0 * xj[k] - 2.0) + a) / (1.0 + a);
+        }
+    }
+}
+
+// exp(-|x|^2)
+void gaussian(const double* x, int dims, double* f) {
+    for (int k = 0; k < BATCH; k++) f[k] = 0.0;
+    for (int j = 0; j < dims; j++) {
+        const double* xj = x + j * BATCH;
+        for (int k = 0; k < BATCH; k++) {
+            f[k] += xj[k] * xj[k];
+        }
+    }
+    for (int k = 0; k < BATCH; k++) f[k] = exp(-f[k]);
+}
+
+// running mean and sum of squared deviations (Welford), merged with the formula of Chan et al.
+struct moments{
+    double n;
+    double mean;
+    double m2;
+};
+
+void add_sample(struct moments* m, double value) {
+    m->n += 1;
+    double delta = value - m->mean;
+    m->mean += delta / m->n;
+    m->m2 += delta * (value - m->mean);
+}
+
+void merge_moments(struct moments* into, const struct moments* from) {
+    double n = into->n + from->n;
+    if (n == 0) return;
+    double delta = from->mean - into->mean;
+    into->mean += delta * from->n / n;
+    into->m2 += from->m2 + delta * delta * into->n * from->n / n;
+    into->n = n;
+}
+
+void merge_moments_op(void* in, void* inout, int* len, MPI_Datatype* type) {
+    (void)type;
+    for (int i = 0; i < *len; i++) {
+        merge_moments((struct moments*)inout + i, (const struct moments*)in + i);
+    }
+}
+
+struct stream{
+    uint64_t rng;                 // mc: the generator state
+    uint32_t shift[MAX_DIMS];     // qmc: the digital shift
+    uint32_t point[MAX_DIMS];     // qmc: the current Sobol point, before the shift
+    uint32_t index;               // qmc: its index
+    struct moments samples;       // the integrand values
+};
+
+void init_stream(struct stream* st, uint64_t seed, int rank, int thread, int s, int dims) {
+    uint64_t state = seed;
+    state = splitmix64(&state) ^ (uint64_t)rank;
+    state = splitmix64(&state) ^ (uint64_t)thread;
+    state = splitmix64(&state) ^ (uint64_t)s;
+    memset(st, 0, sizeof(*st));
+    st->rng = splitmix64(&state);
+    for (int j = 0; j < dims; j++) {
+        st->shift[j] = (uint32_t)(splitmix64(&state) >> 32);
+    }
+}
+
+// the next BATCH points of a stream, Sobol points in Gray code order: point i+1 is point i XOR the direction
+// number of the lowest zero bit of i
+void next_batch(struct stream* st, int dims, int qmc, double* x) {
+    for (int k = 0; k < BATCH; k++) {
+        if (qmc) {
+            for (int j = 0; j < dims; j++) {
+                x[j * BATCH + k] = ((st->point[j] ^ st->shift[j]) + 0.5) * 0x1p-32;
+            }
+            int c = __builtin_ctz(~st->index);
+            for (int j = 0; j < dims; j++) {
+                st->point[j] ^= directions[j][c];
+            }
+            st->index++;
+        }
+        else {
+            for (int j = 0; j < dims; j++) {
+                x[j * BATCH + k] = ((splitmix64(&st->rng) >> 11) + 0.5) * 0x1p-53;
+            }
+        }
+    }
+}
+
+// what this rank's streams say: [0] over all integrand values, [1] over the stream means
+// the mc error comes from [0], the qmc points are not independent so its error comes from the spread of [1]
+void local_statistics(const struct stream* streams, int count, struct moments* stats) {
+    memset(stats, 0, 2 * sizeof(struct moments));
+    for (int s = 0; s < count; s++) {
+        merge_moments(&stats[0], &streams[s].samples);
+        add_sample(&stats[1], streams[s].samples.mean);
+    }
+}
+
+// half width of the confidence interval of the estimate
+double half_width(const struct moments* stats, int qmc) {
+    const struct moments* m = &stats[qmc ? 1 : 0];
+    if (m->n < 2) return INFINITY;
+    return Z95 * sqrt(m->m2 / (m->n - 1) / m->n);
+}
+
+// build with mpicc -O3 -fopenmp qmcIntegral.c -o out -lm
+// usage: mpirun -np P ./out threads [dims] [integrand] [method] [target] [max_points] [seed]
+// integrand is gfunc (default) or gauss, method is qmc (default) or mc, target is the 95% half width to reach
+int main(int argc, char** argv) {
+    int rank, size;
+    int threads = argc > 1 ? atoi(argv[1]) : 1;
+    int dims = argc > 2 ? atoi(argv[2]) : 10;
+    const char* integrand = argc > 3 ? argv[3] : "gfunc";
+    int qmc = argc > 4 ? strcmp(argv[4], "mc") != 0 : 1;
+    double target = argc > 5 ? atof(argv[5]) : 1e-4;
+    double max_points = argc > 6 ? atof(argv[6]) : 1e9;
+    uint64_t seed = argc > 7 ? strtoull(argv[7], NULL, 10) : 1;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (threads < 1 || dims < 1 || dims > MAX_DIMS) {
+        if (rank == 0) printf("Needs threads >= 1 and 1 <= dims <= %d\n", MAX_DIMS);
+        MPI_Finalize();
+        return 1;
+    }
+
+    batch_integrand_t f = g_function;
+    double exact = 1.0;
+    if (strcmp(integrand, "gauss") == 0) {
+        f = gaussian;
+        exact = pow(sqrt(M_PI) / 2 * erf(1.0), dims);
+    }
+    init_directions(dims);
+    omp_set_num_threads(threads);
+    int count = threads * STREAMS_PER_THREAD;
+    struct stream* streams = malloc(sizeof(struct stream) * count);
+    for (int t = 0; t < threads; t++) {
+        for (int s = 0; s < STREAMS_PER_THREAD; s++) {
+            init_stream(&streams[t * STREAMS_PER_THREAD + s], seed, rank, t, s, dims);
+        }
+    }
+
+    MPI_Datatype moments_type;
+    MPI_Op merge_op;
+    MPI_Type_contiguous(3, MPI_DOUBLE, &moments_type);
+    MPI_Type_commit(&moments_type);
+    MPI_Op_create(merge_moments_op, 1, &merge_op);
+
+    if (rank == 0) {
+        printf("Integrand %s in %d dimensions, %s with %d streams, target half width %g\n",
+               strcmp(integrand, "gauss") == 0 ? "gauss" : "gfunc", dims, qmc ? "scrambled Sobol" : "Monte Carlo",
+               count * size, target);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    struct moments local[2], global[2];
+    MPI_Request request = MPI_REQUEST_NULL;
+    int rounds = 0, checks = 0, stop = 0;
+    while (!stop) {
+        #pragma omp parallel
+        {
+            double* x = malloc(sizeof(double) * dims * BATCH);
+            double fx[BATCH];
+            #pragma omp for schedule(static)
+            for (int s = 0; s < count; s++) {
+                for (int b = 0; b < ROUND / BATCH; b++) {
+                    next_batch(&streams[s], dims, qmc, x);
+                    f(x, dims, fx);
+                    for (int k = 0; k < BATCH; k++) {
+                        add_sample(&streams[s].samples, fx[k]);
+                    }
+                }
+            }
+            free(x);
+        }
+        rounds++;
+
+        // the reduction started after an earlier round ran while this one was computed
+        int done = 1;
+        if (request != MPI_REQUEST_NULL) {
+            MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+            if (done) {
+                checks++;
+                stop = half_width(global, qmc) <= target || global[0].n >= max_points;
+            }
+        }
+        // the ranks may be a round apart when they start a reduction, but they all get the same result from it
+        // and so all of them stop after the same one; that is why the point cap is checked on the reduced count
+        // and never on a rank's own rounds, or the ranks could start different numbers of reductions
+        if (!stop && done) {
+            local_statistics(streams, count, local);
+            MPI_Iallreduce(local, global, 2, moments_type, merge_op, MPI_COMM_WORLD, &request);
+        }
+    }
+    if (request != MPI_REQUEST_NULL) {
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+    }
+
+    // the final numbers, over all the rounds every rank did
+    local_statistics(streams, count, local);
+    MPI_Allreduce(local, global, 2, moments_type, merge_op, MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
+
+    if (rank == 0) {
+        double estimate = qmc ? global[1].mean : global[0].mean;
+        printf("\n");
+        printf("########%s Results######## \n", qmc ? "Quasi-Monte Carlo" : "Monte Carlo");
+        printf("The integral is: %.10f +- %g (95%%)\n", estimate, half_width(global, qmc));
+        printf("The actual error is %g\n", fabs(estimate - exact));
+        printf("Points: %.0f in %d rounds, %d interval checks\n", global[0].n, rounds, checks);
+        printf("The time took to complete the operation is: %f\n", elapsed);
+    }
+
+    MPI_Op_free(&merge_op);
+    MPI_Type_free(&moments_type);
+    free(streams);
+    MPI_Finalize();
+    return 0;
+}
@@ -1,34 +1,477 @@
 #include <mpi.h>
+#include <omp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
-// Function to evaluate the curve (y = f(x))
-float f(float x) {
-    return x * x ; // Example: y = x^2
+// the curves y = f(x) that can be integrated
+static inline double square(double x) { return x * x; } // Example: y = x^2
+static inline double peak(double x) { return 1.0 / (1e-4 + (x - 0.3) * (x - 0.3)); } // sharp peak at 0.3, flat elsewhere
+static inline double root(double x) { return sqrt(x); }                                // infinite slope at 0
+
+// trapezoids over n intervals of width h: h * (f(x_0)/2 + f(x_1) + ... + f(x_{n-1}) + f(x_n)/2) with x_i = a + i*h,
+// every point is evaluated once and x comes from its index, so there is no drifting x += d
+// the points go in fixed blocks of BLOCK, each rank sums whole blocks and rank 0 adds the block sums pairwise,
+// so the result is the same to the last bit for any number of ranks
+#define BLOCK 4096  // points per block sum
+#define LANES 16    // independent accumulators in a block, enough for any vector width to fill
+
+// a kernel per integrand, so that the integrand inlines into the loop and the lanes become vector operations
+#define TRAPEZOID_KERNEL(name, integrand)                              \
+double name(double a, double h, long i0, long i1) {                    \
+    double acc[LANES] = {0};                                           \
+    long i = i0;                                                       \
+    for (; i + LANES <= i1; i += LANES) {                              \
+        double base = (double)i;                                       \
+        for (int l = 0; l < LANES; l++) {                              \
+            acc[l] += integrand(a + (base + l) * h);                   \
+        }                                                              \
+    }                                                                  \
+    for (int l = 0; i < i1; i++, l++) {                                \
+        acc[l] += integrand(a + (double)i * h);                        \
+    }                                                                  \
+    for (int width = LANES / 2; width > 0; width /= 2) {               \
+        for (int l = 0; l < width; l++) {                              \
+            acc[l] += acc[l + width];                                  \
+        }                                                              \
+    }                                                                  \
+    return acc[0];                                                     \
 }
 
-// Function to compute the area of a trapezoid
-float trapezoid_area(float a, float b, float d) { 
-    float area = 0;
-    for (float x = a; x < b; x+=d) {
-        area += f(x) + f(x+d);
+TRAPEZOID_KERNEL(trapezoid_square, square)
+TRAPEZOID_KERNEL(trapezoid_peak, peak)
+TRAPEZOID_KERNEL(trapezoid_root, root)
+
+typedef double (*trapezoid_kernel_t)(double, double, long, long);
+
+// pairwise sum, its rounding error grows with log n instead of n
+double pairwise_sum(const double* x, long n) {
+    if (n <= 8) {
+        double sum = 0;
+        for (long k = 0; k < n; k++) {
+            sum += x[k];
+        }
+        return sum;
     }
-    
-    return area * d / 2.0f;
+    return pairwise_sum(x, n / 2) + pairwise_sum(x + n / 2, n - n / 2);
+}
+
+// the block sums of blocks k0..k1-1 of the points 0..n
+void trapezoid_blocks(trapezoid_kernel_t kernel, double a, double h, long n, long k0, long k1, double* sums) {
+    for (long k = k0; k < k1; k++) {
+        long i1 = (k + 1) * BLOCK < n + 1 ? (k + 1) * BLOCK : n + 1;
+        sums[k - k0] = kernel(a, h, k * BLOCK, i1);
+    }
+}
+
+// adaptive quadrature, Gauss-Kronrod 7/15 on each subinterval until its error estimate is small enough
+// subintervals that are not yet accurate enough go back on the rank's stack, and a rank whose stack runs dry
+// steals half of another rank's stack, so a rank stuck with the expensive part of [a,b] gets help
+#define PIECES_PER_RANK 8      // [a,b] starts out cut into this many pieces per rank
+#define FULL_WEIGHT (1LL << 40) // weight of one starting piece, halved with every split
+#define TAG_STEAL 1
+#define TAG_WORK 2
+#define TAG_REPORT 3
+#define TAG_STOP 4
+
+typedef double (*integrand_t)(double);
+
+struct integrand{
+    const char* name;
+    integrand_t f;
+    trapezoid_kernel_t trapezoid;
+    double exact; // over [0,1]
+};
+
+#define INTEGRANDS 3
+const struct integrand integrands[INTEGRANDS] = {{"square", square, trapezoid_square, 1.0 / 3.0},
+                                                 {"peak", peak, trapezoid_peak, 309.3986915124149}, // 100 (atan 70 + atan 30)
+                                                 {"root", root, trapezoid_root, 2.0 / 3.0}};
+
+// by name or by its number in integrands
+const struct integrand* find_integrand(const char* name) {
+    for (int k = 0; k < INTEGRANDS; k++) {
+        if (strcmp(name, integrands[k].name) == 0) return &integrands[k];
+    }
+    char* end;
+    long id = strtol(name, &end, 10);
+    return *end == '\0' && end != name && id >= 0 && id < INTEGRANDS ? &integrands[id] : NULL;
+}
+
+// a piece of [a,b], the weight says how much of [a,b] it is in units of FULL_WEIGHT per starting piece,
+// it is kept as a double so that pieces travel as plain MPI_DOUBLE triples
+struct interval{
+    double lo;
+    double hi;
+    double weight;
+};
+
+struct interval_stack{
+    struct interval* items;
+    int count;
+    int capacity;
+};
+
+void push_interval(struct interval_stack* stack, double lo, double hi, double weight) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? 2 * stack->capacity : 64;
+        stack->items = realloc(stack->items, sizeof(struct interval) * stack->capacity);
+    }
+    stack->items[stack->count].lo = lo;
+    stack->items[stack->count].hi = hi;
+    stack->items[stack->count].weight = weight;
+    stack->count++;
+}
+
+// Kronrod nodes (the odd ones are the Gauss nodes) and weights, as in QUADPACK
+static const double xgk[8] = {0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+                              0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+                              0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+                              0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+static const double wgk[8] = {0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+                              0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+                              0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+                              0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+static const double wg[4] = {0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+                             0.381830050505118944950369775488975, 0.417959183673469387755102040816327};
+
+// 15 evaluations, returns the Kronrod result and the difference to the 7 point Gauss result as its error
+double gauss_kronrod(integrand_t f, double lo, double hi, double* error) {
+    double center = 0.5 * (lo + hi), half = 0.5 * (hi - lo);
+    double fc = f(center);
+    double kronrod = fc * wgk[7], gauss = fc * wg[3];
+    for (int j = 0; j < 7; j++) {
+        double fsum = f(center - half * xgk[j]) + f(center + half * xgk[j]);
+        kronrod += wgk[j] * fsum;
+        if (j % 2 == 1) {
+            gauss += wg[j / 2] * fsum;
+        }
+    }
+    *error = fabs((kronrod - gauss) * half);
+    return kronrod * half;
+}
+
+// rank 0 counts the weight every rank has finished, when it adds up to all of [a,b] everybody stops
+struct adaptive_result{
+    double area;
+    double error;
+    long evaluations;
+    long intervals;
+    long stolen;
+};
+
+// gives half of the stack to whoever asks, the oldest (widest) pieces since those hold the most work
+void serve_steal(struct interval_stack* stack, int thief) {
+    int give = stack->count / 2;
+    MPI_Send(stack->items, 3 * give, MPI_DOUBLE, thief, TAG_WORK, MPI_COMM_WORLD);
+    memmove(stack->items, stack->items + give, sizeof(struct interval) * (stack->count - give));
+    stack->count -= give;
+}
+
+void adaptive_integrate(integrand_t f, double a, double b, double tol, int rank, int size, struct adaptive_result* result) {
+    struct interval_stack stack = {NULL, 0, 0};
+    long long total_weight = (long long)PIECES_PER_RANK * size * FULL_WEIGHT;
+    long long done_weight = 0, unreported = 0; // rank 0 adds up done_weight for everybody
+    double piece = (b - a) / (PIECES_PER_RANK * size);
+    for (int k = PIECES_PER_RANK - 1; k >= 0; k--) {
+        int index = rank * PIECES_PER_RANK + k;
+        push_interval(&stack, a + index * piece, index + 1 == PIECES_PER_RANK * size ? b : a + (index + 1) * piece, FULL_WEIGHT);
+    }
+    memset(result, 0, sizeof(*result));
+
+    int stop = 0, waiting = 0, victim = rank, flag;
+    MPI_Status status;
+    while (!stop) {
+        // answer whoever is asking, then do one piece
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        if (flag) {
+            if (status.MPI_TAG == TAG_STEAL) {
+                MPI_Recv(NULL, 0, MPI_INT, status.MPI_SOURCE, TAG_STEAL, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                serve_steal(&stack, status.MPI_SOURCE);
+            }
+            else if (status.MPI_TAG == TAG_WORK) {
+                int count;
+                MPI_Get_count(&status, MPI_DOUBLE, &count);
+                struct interval* stolen = malloc(sizeof(double) * (count > 0 ? count : 1));
+                MPI_Recv(stolen, count, MPI_DOUBLE, status.MPI_SOURCE, TAG_WORK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                for (int k = 0; k < count / 3; k++) {
+                    push_interval(&stack, stolen[k].lo, stolen[k].hi, stolen[k].weight);
+                }
+                result->stolen += count / 3;
+                free(stolen);
+                waiting = 0;
+            }
+            else if (status.MPI_TAG == TAG_REPORT) {
+                long long weight;
+                MPI_Recv(&weight, 1, MPI_LONG_LONG, status.MPI_SOURCE, TAG_REPORT, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                done_weight += weight;
+            }
+            else {
+                MPI_Recv(NULL, 0, MPI_INT, 0, TAG_STOP, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                stop = 1;
+            }
+            continue;
+        }
+
+        if (stack.count > 0) {
+            struct interval piece = stack.items[--stack.count];
+            double error;
+            double area = gauss_kronrod(f, piece.lo, piece.hi, &error);
+            result->evaluations += 15;
+            // each piece may have its share of the tolerance, pieces too narrow to split are taken as they are
+            if (error <= tol * piece.weight / total_weight || piece.weight < 2) {
+                result->area += area;
+                result->error += error;
+                result->intervals++;
+                unreported += (long long)piece.weight;
+            }
+            else {
+                double mid = 0.5 * (piece.lo + piece.hi);
+                push_interval(&stack, mid, piece.hi, piece.weight / 2);
+                push_interval(&stack, piece.lo, mid, piece.weight / 2);
+            }
+            continue;
+        }
+
+        // out of work: report what was finished, then go and steal from the ranks in turn
+        if (unreported) {
+            if (rank == 0) done_weight += unreported;
+            else MPI_Send(&unreported, 1, MPI_LONG_LONG, 0, TAG_REPORT, MPI_COMM_WORLD);
+            unreported = 0;
+        }
+        if (rank == 0 && done_weight == total_weight) {
+            for (int r = 1; r < size; r++) {
+                MPI_Send(NULL, 0, MPI_INT, r, TAG_STOP, MPI_COMM_WORLD);
+            }
+            stop = 1;
+        }
+        else if (!waiting && size > 1) {
+            victim = (victim + 1) % size == rank ? (victim + 2) % size : (victim + 1) % size;
+            MPI_Send(NULL, 0, MPI_INT, victim, TAG_STEAL, MPI_COMM_WORLD);
+            waiting = 1;
+        }
+    }
+
+    // a steal can still be on its way, every rank answers steals until all of them have their answer
+    MPI_Request barrier = MPI_REQUEST_NULL;
+    int done = 0;
+    while (!done) {
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        if (flag && status.MPI_TAG == TAG_STEAL) {
+            MPI_Recv(NULL, 0, MPI_INT, status.MPI_SOURCE, TAG_STEAL, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Send(NULL, 0, MPI_DOUBLE, status.MPI_SOURCE, TAG_WORK, MPI_COMM_WORLD);
+        }
+        else if (flag && status.MPI_TAG == TAG_WORK) {
+            MPI_Recv(NULL, 0, MPI_DOUBLE, status.MPI_SOURCE, TAG_WORK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            waiting = 0;
+        }
+        if (!waiting && barrier == MPI_REQUEST_NULL) {
+            MPI_Ibarrier(MPI_COMM_WORLD, &barrier);
+        }
+        if (barrier != MPI_REQUEST_NULL) {
+            MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+        }
+    }
+    free(stack.items);
+}
+
+// batch mode: ./out batch jobs.txt [results.txt] [threads] [batch_size]
+// every line of jobs.txt is "integrand a b n", the integrand by name or number, results.txt gets one line per job
+// one start-up for thousands of integrals: every rank takes a share of the blocks of every job in a batch,
+// and the partial sums of a whole batch go to rank 0 in one MPI_Ireduce that runs while the next batch is computed
+#define DEFAULT_JOB_BATCH 1024
+
+struct job{
+    int integrand;
+    double a;
+    double b;
+    long n;
+};
+
+// rank 0 reads the jobs, everybody gets a copy, returns the number of jobs or -1
+int read_jobs(const char* filename, int rank, struct job** jobs) {
+    int count = 0, capacity = 0;
+    *jobs = NULL;
+    if (rank == 0) {
+        FILE* file = fopen(filename, "r");
+        char name[64];
+        struct job job;
+        if (!file) {
+            count = -1;
+        }
+        while (file && fscanf(file, "%63s %lf %lf %ld", name, &job.a, &job.b, &job.n) == 4) {
+            const struct integrand* g = find_integrand(name);
+            if (!g || job.n < 1) {
+                printf("Skipping job %s %g %g %ld\n", name, job.a, job.b, job.n);
+                continue;
+            }
+            job.integrand = (int)(g - integrands);
+            if (count == capacity) {
+                capacity = capacity ? 2 * capacity : 1024;
+                *jobs = realloc(*jobs, sizeof(struct job) * capacity);
+            }
+            (*jobs)[count++] = job;
+        }
+        if (file) fclose(file);
+    }
+    MPI_Bcast(&count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (count > 0) {
+        if (rank != 0) *jobs = malloc(sizeof(struct job) * count);
+        MPI_Bcast(*jobs, (int)(sizeof(struct job) * count), MPI_BYTE, 0, MPI_COMM_WORLD);
+    }
+    return count;
+}
+
+// the job that item t of a batch belongs to: the last j with item_start[j] <= t
+static int item_job(const long* item_start, int count, long t) {
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (item_start[mid] <= t) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// this rank's share of jobs[0..count): block k of job j belongs to rank (j + k) % size,
+// so that a job of a single block lands on a different rank than the job before it
+// every block sum gets its own slot and each job's slots are added up pairwise afterwards, so the partial sums
+// do not depend on the number of threads or on which thread finishes first
+void compute_batch(const struct job* jobs, int count, int rank, int size, double* partial, long* item_start) {
+    item_start[0] = 0;
+    for (int j = 0; j < count; j++) {
+        long blocks = (jobs[j].n + BLOCK) / BLOCK;
+        long first = ((rank - j) % size + size) % size; // first block of job j that is ours
+        item_start[j + 1] = item_start[j] + (first < blocks ? (blocks - first + size - 1) / size : 0);
+    }
+    long items = item_start[count];
+    double* item_sums = malloc(sizeof(double) * (items > 0 ? items : 1));
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (long t = 0; t < items; t++) {
+        int j = item_job(item_start, count, t);
+        const struct job* job = &jobs[j];
+        double h = (job->b - job->a) / (double)job->n;
+        long k = ((rank - j) % size + size) % size + (t - item_start[j]) * size;
+        long i1 = (k + 1) * BLOCK < job->n + 1 ? (k + 1) * BLOCK : job->n + 1;
+        item_sums[t] = integrands[job->integrand].trapezoid(job->a, h, k * BLOCK, i1);
+    }
+    for (int j = 0; j < count; j++) {
+        partial[j] = pairwise_sum(item_sums + item_start[j], item_start[j + 1] - item_start[j]);
+    }
+    free(item_sums);
+}
+
+// rank 0 turns the reduced sums into areas
+void write_results(FILE* file, const struct job* jobs, int first, int count, const double* sums) {
+    for (int j = 0; j < count; j++) {
+        const struct job* job = &jobs[first + j];
+        const struct integrand* g = &integrands[job->integrand];
+        double h = (job->b - job->a) / (double)job->n;
+        double area = (sums[j] - (g->f(job->a) + g->f(job->b)) / 2) * h;
+        fprintf(file, "%d %s %.17g %.17g %ld %.17g\n", first + j, g->name, job->a, job->b, job->n, area);
+    }
+}
+
+int batch_main(int argc, char** argv) {
+    int rank, size;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    const char* results_name = argc > 3 ? argv[3] : "results.txt";
+    if (argc > 4) omp_set_num_threads(atoi(argv[4]));
+    int batch = argc > 5 ? atoi(argv[5]) : DEFAULT_JOB_BATCH;
+
+    struct job* jobs;
+    int count = argc > 2 && batch > 0 ? read_jobs(argv[2], rank, &jobs) : -1;
+    FILE* results = NULL;
+    int opened = 1;
+    if (rank == 0 && count >= 0) {
+        results = fopen(results_name, "w");
+        opened = results != NULL;
+    }
+    // read_jobs has given every rank the count already, only whether root could open the results file is new
+    MPI_Bcast(&opened, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (count < 0 || !opened) {
+        if (rank == 0) printf("usage: batch jobs.txt [results.txt] [threads] [batch_size]\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // two sets of buffers, batch b reduces out of one while batch b + 1 is computed into the other
+    double* partial[2] = {malloc(sizeof(double) * batch), malloc(sizeof(double) * batch)};
+    double* sums[2] = {malloc(sizeof(double) * batch), malloc(sizeof(double) * batch)};
+    long* item_start = malloc(sizeof(long) * (batch + 1));
+    MPI_Request requests[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    int first[2] = {0, 0}, counts[2] = {0, 0};
+    long points = 0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    int cur = 0;
+    for (int j0 = 0; j0 < count; j0 += batch) {
+        int c = count - j0 < batch ? count - j0 : batch;
+        // the batch before last is done with its buffers by now, unless the reduction is still going
+        MPI_Wait(&requests[cur], MPI_STATUS_IGNORE);
+        if (rank == 0 && counts[cur] > 0) {
+            write_results(results, jobs, first[cur], counts[cur], sums[cur]);
+        }
+        compute_batch(jobs + j0, c, rank, size, partial[cur], item_start);
+        MPI_Ireduce(partial[cur], sums[cur], c, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &requests[cur]);
+        first[cur] = j0;
+        counts[cur] = c;
+        for (int j = 0; j < c; j++) points += jobs[j0 + j].n + 1;
+        cur ^= 1;
+    }
+    // the last two batches
+    for (int k = 0; k < 2; k++, cur ^= 1) {
+        MPI_Wait(&requests[cur], MPI_STATUS_IGNORE);
+        if (rank == 0 && counts[cur] > 0) {
+            write_results(results, jobs, first[cur], counts[cur], sums[cur]);
+        }
+        counts[cur] = 0;
+    }
+    double elapsed = MPI_Wtime() - start;
+
+    if (rank == 0) {
+        fclose(results);
+        printf("########Batch Results######## \n");
+        printf("%d integrals (%ld points) in batches of %d on %d ranks, written to %s\n", count, points, batch, size, results_name);
+        printf("The time took to complete the operation is: %f\n", elapsed);
+        printf("That is %f integrals per second\n", count / elapsed);
+    }
+
+    free(partial[0]);
+    free(partial[1]);
+    free(sums[0]);
+    free(sums[1]);
+    free(item_start);
+    free(jobs);
+    MPI_Finalize();
+    return 0;
 }
 
 int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        return batch_main(argc, argv);
+    }
     int rank, size;
-    float a = 0.0f, b = 1.0f;  // Limits of integration
+    double a = 0.0, b = 1.0;  // Limits of integration
     int n;
-    float start, end, local_area, total_area;
+    double total_area = 0;
 
     //assume n is given
     n = 20000000;
+
+    // arguments are [integrand] [tolerance], the integrand is square (default), peak or root
+    // and the tolerance is for the adaptive integrator
+    const struct integrand* g = argc > 1 && find_integrand(argv[1]) ? find_integrand(argv[1]) : &integrands[0];
+    double tol = argc > 2 ? atof(argv[2]) : 1e-10;
     
     double sequential_start, sequential_end,sequential_time;
     double sequential_area = 0;
-    float d = (b - a) / n; // delta 
+    double h = (b - a) / (double)n; // delta
+    long blocks = ((long)n + BLOCK) / BLOCK; // over the n + 1 points
+    double* block_sums = NULL;
 
 
     //Parallel Implementation
@@ -53,14 +496,16 @@ int main(int argc, char** argv) {
         sequential_start = MPI_Wtime();
 
 
-        sequential_area = trapezoid_area(a, b, d);
+        block_sums = malloc(sizeof(double) * blocks);
+        trapezoid_blocks(g->trapezoid, a, h, n, 0, blocks, block_sums);
+        sequential_area = (pairwise_sum(block_sums, blocks) - (g->f(a) + g->f(b)) / 2) * h;
         
         sequential_end = MPI_Wtime();
         sequential_time = sequential_end - sequential_start;
 
         printf("\n");
         printf("########Sequential Results######## \n");
-        printf("The total area under the curve is: %f\n", sequential_area);
+        printf("The total area under the curve is: %.15f\n", sequential_area);
         printf("The time took to complete the operation is: %f  \n", sequential_time);
 
     }
@@ -71,19 +516,22 @@ int main(int argc, char** argv) {
     // Broadcast the number of intervals to all processes
     MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
     
-    // Calculate the interval size for each process
+    // Each process gets a run of whole blocks
+    long k0 = rank * blocks / size, k1 = (rank + 1) * blocks / size;
+    double* local_sums = malloc(sizeof(double) * (k1 > k0 ? k1 - k0 : 1));
+    trapezoid_blocks(g->trapezoid, a, h, n, k0, k1, local_sums);
 
-    float region = (b - a)/ size;
-    
-    // Calculate local bounds for each process
-    start = a + rank * region;
-    end = start + region;
-    
-    // Each process calculates the area of its subinterval
-    local_area = trapezoid_area(start, end, d);
-    
-    // Reduce all local areas to the total area on the root process
-    MPI_Reduce(&local_area, &total_area, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+    // Gather the block sums on the root process, which adds them up in the same order as the sequential run
+    int* counts = malloc(sizeof(int) * size);
+    int* displs = malloc(sizeof(int) * size);
+    for (int r = 0; r < size; r++) {
+        displs[r] = (int)(r * blocks / size);
+        counts[r] = (int)((r + 1) * blocks / size) - displs[r];
+    }
+    MPI_Gatherv(local_sums, (int)(k1 - k0), MPI_DOUBLE, block_sums, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        total_area = (pairwise_sum(block_sums, blocks) - (g->f(a) + g->f(b)) / 2) * h;
+    }
 
     parallel_end = MPI_Wtime();
 
@@ -93,13 +541,39 @@ int main(int argc, char** argv) {
     if (rank == 0) {
         printf("\n");
         printf("########Parallel Results######## \n");
-        printf("The total area under the curve is: %f\n", total_area);
+        printf("The total area under the curve is: %.15f\n", total_area);
         printf("The time took to complete the operation is: %f\n", parallel_time);
         printf("\n");
 
         float speed_up =  sequential_time/parallel_time;
         printf("The speedup factor is %f \n",speed_up);
         printf("The efficiency is %f",(float)(speed_up/size)*100);
+        printf("\nThe parallel area is %s the sequential one, the actual error is %g",
+               total_area == sequential_area ? "identical to" : "different from", fabs(total_area - g->exact));
+    }
+    free(local_sums);
+    free(counts);
+    free(displs);
+    free(block_sums);
+
+    // same accuracy for fewer evaluations, the trapezoids above spend n + 1 of them
+    struct adaptive_result local, global;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double adaptive_start = MPI_Wtime();
+    adaptive_integrate(g->f, a, b, tol, rank, size, &local);
+    MPI_Reduce(&local.area, &global.area, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local.evaluations, &global.evaluations, 3, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    double adaptive_time = MPI_Wtime() - adaptive_start;
+
+    if (rank == 0) {
+        printf("\n\n");
+        printf("########Adaptive Results######## \n");
+        printf("Integrand %s, tolerance %g\n", g->name, tol);
+        printf("The total area under the curve is: %.15f\n", global.area);
+        printf("The estimated error is %g, the actual error is %g\n", global.error, fabs(global.area - g->exact));
+        printf("Function evaluations: %ld in %ld subintervals (%ld moved by stealing)\n",
+               global.evaluations, global.intervals, global.stolen);
+        printf("The time took to complete the operation is: %f\n", adaptive_time);
     }
     
     MPI_Finalize(); // Finalize MPI
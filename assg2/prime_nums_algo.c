@@ -1,193 +1,554 @@
 #include <mpi.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
 
+#define SEGMENT_BYTES (32 * 1024) // one segment fits in L1, bit i of a segment stands for the odd number lo + 2*i
+#define SEGMENT_SPAN ((long long)SEGMENT_BYTES * 8 * 2) // numbers covered by one segment
 
-int* generate_primes(int n){
 
-    int* primes = malloc((n+1)* sizeof(int));  // 1 --> prime, 0 --> composite
-    for(int i = 2;i<=n;++i){
-        primes[i]=1;
-    }
-    
-    for(int p = 2;p<=(int)sqrt(n);++p){
+// integer square root, sqrt() on a double can be off by one for large n
+long long isqrt(long long n){
+    long long r = (long long)sqrt((double)n);
+    while(r * r > n) --r;
+    while((r + 1) * (r + 1) <= n) ++r;
+    return r;
+}
+
+// odd-only bit-packed sieve, returns the primes <= limit in increasing order and stores how many in *count
+int* sieve_small_primes(int limit, int* count){
 
-        if(primes[p]==1){ // if it is prime
+    int nbits = (limit + 1) / 2; // bit i --> 2*i+1
+    uint64_t* composite = calloc(nbits / 64 + 1, sizeof(uint64_t));
 
-            for(int j = p*p;j<=n;j+=p){
-                primes[j] = 0;
+    for(long long i = 1; (2*i+1)*(2*i+1) <= limit; ++i){
+        if(!(composite[i >> 6] & (1ULL << (i & 63)))){ // if it is prime
+            long long p = 2*i+1;
+            for(long long j = p*p/2; j < nbits; j += p){
+                composite[j >> 6] |= 1ULL << (j & 63);
             }
         }
     }
 
+    *count = limit >= 2 ? 1 : 0;
+    for(int i = 1; i < nbits; ++i){
+        if(!(composite[i >> 6] & (1ULL << (i & 63)))) (*count)++;
+    }
+
+    int* primes = malloc((*count + 1) * sizeof(int));
+    int idx = 0;
+    if(limit >= 2) primes[idx++] = 2;
+    for(int i = 1; i < nbits; ++i){
+        if(!(composite[i >> 6] & (1ULL << (i & 63)))) primes[idx++] = 2*i+1;
+    }
+
+    free(composite);
     return primes;
+}
+
+// counts the primes in [lo, hi) with a segmented sieve, primes must hold every prime <= sqrt(hi-1)
+// each OpenMP thread sieves whole segments in its own L1 sized buffer, so memory is one segment per thread
+long long count_primes_segmented(long long lo, long long hi, const int* primes, int count){
+
+    long long total = 0;
+    if(lo <= 2 && hi > 2) total = 1; // 2 is the only even prime, the segments hold odd numbers only
+    if(lo < 3) lo = 3;
+    if(!(lo & 1)) lo++;
+    if(lo >= hi) return total;
+
+    long long segments = (hi - lo + SEGMENT_SPAN - 1) / SEGMENT_SPAN;
+
+    #pragma omp parallel reduction(+:total)
+    {
+        uint64_t* segment = malloc(SEGMENT_BYTES);
+
+        #pragma omp for schedule(dynamic)
+        for(long long s = 0; s < segments; ++s){
+            long long seg_lo = lo + s * SEGMENT_SPAN;
+            long long seg_hi = seg_lo + SEGMENT_SPAN < hi ? seg_lo + SEGMENT_SPAN : hi;
+            long long nbits = (seg_hi - seg_lo + 1) / 2;
+            long long nwords = (nbits + 63) / 64;
+            memset(segment, 0, nwords * sizeof(uint64_t));
+
+            for(int k = 1; k < count; ++k){ // skip 2
+                long long p = primes[k];
+                if(p * p >= seg_hi) break;
+
+                // first odd multiple of p inside the segment, never below p*p
+                long long start = p * p;
+                if(start < seg_lo){
+                    start = (seg_lo + p - 1) / p * p;
+                    if(!(start & 1)) start += p;
+                }
+                for(long long j = (start - seg_lo) / 2; j < nbits; j += p){
+                    segment[j >> 6] |= 1ULL << (j & 63);
+                }
+            }
 
+            long long marked = 0;
+            for(long long w = 0; w < nwords; ++w){
+                marked += __builtin_popcountll(segment[w]);
+            }
+            total += nbits - marked;
+        }
 
+        free(segment);
+    }
+
+    return total;
 }
 
-int main(int argc, char** argv){
+// each rank owns a contiguous block of [2, n] and sieves it with its OpenMP threads, rank 0 gets the total
+long long hybrid_sieve(long long n, int rank, int size, const int* primes, int count){
 
-    int rank, size;
-    double sequential_start, sequential_end,sequential_time;
-    double parallel_start, parallel_end, parallel_time;
-    int n = 8010000; // we need to check all the prime numbers that come before n
+    long long block = (n - 1 + size - 1) / size;
+    long long lo = 2 + rank * block;
+    long long hi = lo + block < n + 1 ? lo + block : n + 1;
 
-    MPI_Init(&argc,&argv);
-    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
-    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    long long local_count = lo < hi ? count_primes_segmented(lo, hi, primes, count) : 0;
+    long long total_count = 0;
+    MPI_Reduce(&local_count, &total_count, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
+    return total_count;
+}
 
-    if(rank == 0){
-       
+// a stage passes its survivors on in batches, the last batch of a stage is tagged TAG_LAST
+#define DEFAULT_BATCH 4096
+#define TAG_BATCH 0
+#define TAG_LAST 1
+
+// double buffered outgoing batches, one buffer is filled while the other one is in flight
+struct batch_sender{
+    int* buf[2];
+    MPI_Request req[2];
+    int cur;
+    int fill;
+    int batch;
+    int dest;
+    double waited; // seconds spent blocked on the next stage
+};
+
+void sender_init(struct batch_sender* s, int batch, int dest){
+    s->buf[0] = malloc(batch * sizeof(int));
+    s->buf[1] = malloc(batch * sizeof(int));
+    s->req[0] = s->req[1] = MPI_REQUEST_NULL;
+    s->cur = 0;
+    s->fill = 0;
+    s->batch = batch;
+    s->dest = dest;
+    s->waited = 0;
+}
 
-        sequential_start = MPI_Wtime();
-        generate_primes(n);
-        sequential_end = MPI_Wtime();
-        sequential_time = sequential_end - sequential_start;
+void sender_flush(struct batch_sender* s, int tag){
+    MPI_Isend(s->buf[s->cur], s->fill, MPI_INT, s->dest, tag, MPI_COMM_WORLD, &s->req[s->cur]);
+    s->cur ^= 1;
+    double wait_start = MPI_Wtime();
+    MPI_Wait(&s->req[s->cur], MPI_STATUS_IGNORE); // the other buffer has to be delivered before we refill it
+    s->waited += MPI_Wtime() - wait_start;
+    s->fill = 0;
+}
+
+void sender_push(struct batch_sender* s, int num){
+    s->buf[s->cur][s->fill++] = num;
+    if(s->fill == s->batch){
+        sender_flush(s, TAG_BATCH);
     }
-        
-        MPI_Barrier(MPI_COMM_WORLD);
-        parallel_start = MPI_Wtime();
+}
 
-       
-        // parallel implementation
-        // consider having n processors, each proccessor will eliminate some multiple of a number and pass it to next one
-        // buffer to hold primes at each process
-
-        
-
-        int total_primes;
-        int* primes_to_gen;
-        if(rank == 0 ){
-            
-           primes_to_gen = generate_primes((int) sqrt(n));
-           
-    
-            total_primes = 0;
-            for (int i = 2; i <= (int)sqrt(n); ++i) {
-                if (primes_to_gen[i]) {
-                    total_primes++;
-                }
-            }
-            
+// sends what is left together with the termination tag and waits for both buffers
+void sender_finish(struct batch_sender* s){
+    sender_flush(s, TAG_LAST);
+    double wait_start = MPI_Wtime();
+    MPI_Waitall(2, s->req, MPI_STATUSES_IGNORE);
+    s->waited += MPI_Wtime() - wait_start;
+    free(s->buf[0]);
+    free(s->buf[1]);
+}
+
+// the last stage streams the primes it finds to a file, each prime is stored as the LEB128 varint of its gap to the previous one
+// the file starts with the magic "PDLT", n and the number of primes as two int64, the count is filled in when the file is closed
+#define WRITE_BUFFER (1 << 20)
+
+// double buffered like batch_sender, one buffer is encoded into while MPI_File_iwrite drains the other one
+struct prime_writer{
+    MPI_File fh;
+    unsigned char* buf[2];
+    MPI_Request req;
+    int cur;
+    int fill;
+    long long previous;
+    long long count;
+};
+
+int writer_open(struct prime_writer* w, const char* filename, long long n){
+    if(MPI_File_open(MPI_COMM_SELF, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &w->fh) != MPI_SUCCESS){
+        printf("Could not open %s for writing\n", filename);
+        return 1;
+    }
+    MPI_File_set_size(w->fh, 0);
+    w->buf[0] = malloc(WRITE_BUFFER);
+    w->buf[1] = malloc(WRITE_BUFFER);
+    w->req = MPI_REQUEST_NULL;
+    w->cur = 0;
+    w->previous = 0;
+    w->count = 0;
+
+    long long header[2] = {n, 0};
+    memcpy(w->buf[0], "PDLT", 4);
+    memcpy(w->buf[0] + 4, header, sizeof(header));
+    w->fill = 4 + sizeof(header);
+    return 0;
+}
+
+void writer_flush(struct prime_writer* w){
+    MPI_Wait(&w->req, MPI_STATUS_IGNORE); // at most one write in flight, so the other buffer is free again
+    MPI_File_iwrite(w->fh, w->buf[w->cur], w->fill, MPI_BYTE, &w->req);
+    w->cur ^= 1;
+    w->fill = 0;
+}
+
+void writer_push(struct prime_writer* w, long long prime){
+    unsigned long long gap = prime - w->previous;
+    unsigned char* out = w->buf[w->cur];
+    while(gap >= 0x80){
+        out[w->fill++] = (unsigned char)(gap | 0x80);
+        gap >>= 7;
+    }
+    out[w->fill++] = (unsigned char)gap;
+    w->previous = prime;
+    w->count++;
+    if(w->fill > WRITE_BUFFER - 10){
+        writer_flush(w);
+    }
+}
+
+void writer_close(struct prime_writer* w){
+    writer_flush(w);
+    MPI_Wait(&w->req, MPI_STATUS_IGNORE);
+    MPI_File_write_at(w->fh, 4 + sizeof(long long), &w->count, 1, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+    MPI_File_close(&w->fh);
+    free(w->buf[0]);
+    free(w->buf[1]);
+}
+
+int survives(int num, const int* primes, int count){
+    for (int i = 0; i < count; ++i) {
+        if (num % primes[i] == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// splits the sieving primes into contiguous runs of roughly equal estimated work
+// a candidate that reaches prime p_j costs one modulo, and about candidates * prod_{i<j}(1 - 1/p_i) of them get there
+// est[k] gets the estimated share of the work that stage k ends up with
+void partition_primes(const int* primes, int total_primes, int size, long long candidates, int* counts, int* displs, double* est){
+
+    double* work = malloc((total_primes + 1) * sizeof(double));
+    double arriving = (double)candidates;
+    double total_work = 0;
+    for(int j = 0; j < total_primes; ++j){
+        work[j] = arriving;
+        total_work += arriving;
+        arriving *= 1.0 - 1.0 / primes[j];
+    }
+
+    int j = 0;
+    double done = 0;
+    for(int k = 0; k < size; ++k){
+        displs[k] = j;
+        est[k] = 0;
+        double target = total_work * (k + 1) / size;
+        // take primes while that brings the stage closer to its cut, the last stage takes the rest
+        while(j < total_primes && (k == size - 1 || done + work[j] / 2 <= target)){
+            done += work[j];
+            est[k] += work[j];
+            j++;
         }
-        if(total_primes%size !=0){
-            printf("Cant distribute prime numbers on processors, we have %d prime numbers and %d processors\n",total_primes,size);
-            free(primes_to_gen);
-            MPI_Finalize();
-            return 1;
+        counts[k] = j - displs[k];
+        est[k] = total_work > 0 ? est[k] / total_work : 0;
+    }
+
+    free(work);
+}
+
+// the pipeline head only generates numbers coprime to 2*3*5*7, 48 out of every 210
+#define WHEEL 210
+#define WHEEL_SPOKES 48
+#define WHEEL_LARGEST_PRIME 7
+
+// a number that survived its stage goes to the next stage, or is a prime if this is the last one
+void stage_output(int num, int is_last, struct batch_sender* out, struct prime_writer* writer, long long* found){
+    if(is_last){
+        (*found)++;
+        if(writer){
+            writer_push(writer, num);
         }
-        MPI_Bcast(&total_primes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    else{
+        sender_push(out, num);
+    }
+}
+
+// the pipelined approach, *found gets the number of candidates that survived every stage on rank 0
+// the last stage writes every prime up to n to output unless it is NULL
+void run_pipeline(int n, int rank, int size, int* primes_to_send, int total_primes, int batch, const char* output, long long* found){
 
-        
-        int primes_per_process = total_primes/size;
-        int* recvbuf = malloc(primes_per_process*sizeof(int));
-        int* primes_to_send = malloc(total_primes * sizeof(int));
+        // consider having n processors, each proccessor will eliminate some multiple of a number and pass it to next one
+        // the wheel already removes the multiples of 2, 3, 5 and 7, so the stages only get the sieving primes above those
+        int wheel_skip = 0;
+        while(wheel_skip < total_primes && primes_to_send[wheel_skip] <= WHEEL_LARGEST_PRIME){
+            wheel_skip++;
+        }
+        int* stage_primes = primes_to_send + wheel_skip;
+        int stage_total = total_primes - wheel_skip;
 
+        // the sieving primes are split by estimated work, not by count, so the first stage does not keep the small primes and a lot more
+        int* counts = NULL;
+        int* displs = NULL;
+        double* est = NULL;
         if(rank == 0){
+            counts = malloc(size * sizeof(int));
+            displs = malloc(size * sizeof(int));
+            est = malloc(size * sizeof(double));
+            partition_primes(stage_primes, stage_total, size, (n - isqrt(n)) * WHEEL_SPOKES / WHEEL, counts, displs, est);
+        }
 
-            int idx = 0;
-            for (int i = 2; i <= (int)sqrt(n); ++i) {
-                if (primes_to_gen[i]) {
-                    primes_to_send[idx] = i;
-                    idx++;
-                }
-            }
-             free(primes_to_gen);
+        int primes_per_process;
+        MPI_Scatter(counts, 1, MPI_INT, &primes_per_process, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        int* recvbuf = malloc((primes_per_process + 1)*sizeof(int));
+
+        MPI_Scatterv(stage_primes, counts, displs, MPI_INT, recvbuf, primes_per_process, MPI_INT, 0, MPI_COMM_WORLD);
+
+        double stage_start = MPI_Wtime();
+        double recv_waited = 0;
+        long long candidates_in = 0;
+        int is_last = rank + 1 == size;
+        long long local_found = 0;
+        struct batch_sender out;
+        if(!is_last){
+            sender_init(&out, batch, rank + 1);
         }
-        
-        
-    
-        MPI_Scatter(primes_to_send, primes_per_process, MPI_INT, recvbuf, primes_per_process, MPI_INT, 0, MPI_COMM_WORLD);
 
-        // printf("I am proc %d\n",rank);
-        // for(int i = 0;i<primes_per_process;++i){
-        //     printf("%d ",recvbuf[i]);
-        // }
-        // printf("\n");
-        
+        // the sieving primes are primes as well, so they go into the file first
+        struct prime_writer file;
+        struct prime_writer* writer = NULL;
+        if(is_last && output && writer_open(&file, output, n) == 0){
+            writer = &file;
+            for(int i = 0; i < total_primes; ++i){
+                writer_push(writer, primes_to_send[i]);
+            }
+        }
 
         //start sending other number to check primes
         if(rank == 0){
 
-            for(int num = (int) sqrt(n);num<=n;++num){
+            int wheel[WHEEL_SPOKES];
+            int spokes = 0;
+            for(int r = 1; r < WHEEL; ++r){
+                if(r % 2 && r % 3 && r % 5 && r % 7) wheel[spokes++] = r;
+            }
 
-                int is_prime = 1;
-                for (int i = 0; i < primes_per_process; ++i) {
-                    if (num % recvbuf[i] == 0) {
-                        is_prime = 0;
-                        break;
-                    }
+            // everything up to sqrt(n) is already covered by the sieving primes
+            long long first = isqrt(n) + 1;
+
+            // for tiny n some wheel primes are above sqrt(n), the wheel would skip them
+            int wheel_primes[4] = {2, 3, 5, 7};
+            for(int k = 0; k < 4; ++k){
+                if(wheel_primes[k] >= first && wheel_primes[k] <= n){
+                    candidates_in++;
+                    stage_output(wheel_primes[k], is_last, &out, writer, &local_found);
                 }
-                if (is_prime) {
-                    if(rank+1<size){
-                        MPI_Send(&num, 1, MPI_INT, rank + 1, 0, MPI_COMM_WORLD);
+            }
+
+            for(long long base = first / WHEEL * WHEEL; base <= n; base += WHEEL){
+                for(int k = 0; k < spokes; ++k){
+                    long long num = base + wheel[k];
+                    if(num < first) continue;
+                    if(num > n) break;
+                    candidates_in++;
+                    if (survives((int)num, recvbuf, primes_per_process)) {
+                        stage_output((int)num, is_last, &out, writer, &local_found);
                     }
-                    
                 }
-
             }
-            int terminate = -1;
-            MPI_Send(&terminate,1,MPI_INT,rank+1,0,MPI_COMM_WORLD);
 
         }
         else{
-            int num;
+            // batch k is filtered while batch k+1 is already being received
+            int* in[2];
+            MPI_Request in_req[2];
+            in[0] = malloc(batch * sizeof(int));
+            in[1] = malloc(batch * sizeof(int));
+            int cur = 0;
+            MPI_Irecv(in[cur], batch, MPI_INT, rank - 1, MPI_ANY_TAG, MPI_COMM_WORLD, &in_req[cur]);
 
-            
             while(1){
-                MPI_Recv(&num,1,MPI_INT,rank-1,0,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
-
-                if(num==-1){
-                    if(rank+1<size){
-                        MPI_Send(&num,1,MPI_INT,rank+1,0,MPI_COMM_WORLD);
-                    }
-                    break;
+                MPI_Status status;
+                int count;
+                double wait_start = MPI_Wtime();
+                MPI_Wait(&in_req[cur], &status);
+                recv_waited += MPI_Wtime() - wait_start;
+                MPI_Get_count(&status, MPI_INT, &count);
+                candidates_in += count;
+
+                if(status.MPI_TAG != TAG_LAST){
+                    MPI_Irecv(in[cur ^ 1], batch, MPI_INT, rank - 1, MPI_ANY_TAG, MPI_COMM_WORLD, &in_req[cur ^ 1]);
                 }
 
-                int is_prime = 1;
-                for (int i = 0; i < primes_per_process; ++i) {
-                    if (num % recvbuf[i] == 0) {
-                        is_prime = 0;
-                        break;
+                for(int k = 0; k < count; ++k){
+                    int num = in[cur][k];
+                    if (survives(num, recvbuf, primes_per_process)) {
+                        stage_output(num, is_last, &out, writer, &local_found);
                     }
                 }
-                if (is_prime) {
-                    if (rank + 1 < size) {
-                        MPI_Send(&num, 1, MPI_INT, rank + 1, 0, MPI_COMM_WORLD);
-                    } else {
-                        //printf("%d ", num);
-                        // you can generate the rest of the primes here
-                    }
+
+                if(status.MPI_TAG == TAG_LAST){
+                    break;
                 }
+                cur ^= 1;
             }
-                
+
+            free(in[0]);
+            free(in[1]);
+        }
+
+        double send_waited = 0;
+        if(!is_last){
+            sender_finish(&out);
+            send_waited = out.waited;
+        }
+        if(writer){
+            writer_close(writer);
+        }
+
+        // a stage is busy whenever it is not blocked on one of its neighbours
+        double span = MPI_Wtime() - stage_start;
+        double stats[3] = {span - recv_waited - send_waited, span, (double)candidates_in};
+        double* all_stats = NULL;
+        if(rank == 0){
+            all_stats = malloc(3 * size * sizeof(double));
+        }
+        MPI_Gather(stats, 3, MPI_DOUBLE, all_stats, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&local_found, found, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+        if(rank == 0){
+            double longest = 0;
+            for(int k = 0; k < size; ++k){
+                if(all_stats[3*k+1] > longest) longest = all_stats[3*k+1];
+            }
+            printf("###Pipeline Stages###\n");
+            for(int k = 0; k < size; ++k){
+                int first = counts[k] ? stage_primes[displs[k]] : 0;
+                int last = counts[k] ? stage_primes[displs[k] + counts[k] - 1] : 0;
+                printf("Stage %d: %d primes [%d..%d], %.0f candidates in, estimated work %.1f%%, busy %f s, utilisation %.1f%%\n",
+                       k, counts[k], first, last, all_stats[3*k+2], est[k]*100, all_stats[3*k],
+                       longest > 0 ? all_stats[3*k] / longest * 100 : 0);
+            }
+            free(all_stats);
+            free(counts);
+            free(displs);
+            free(est);
+        }
+
+        free(recvbuf);
+}
+
+int main(int argc, char** argv){
+
+    int rank, size;
+    double sequential_start, sequential_end,sequential_time;
+    double parallel_start, parallel_end, parallel_time;
+    double sieve_start, sieve_end, sieve_time;
+    long long n = 8010000; // we need to check all the prime numbers that come before n
+    long long sequential_count = 0, sieve_count = 0, pipeline_count = 0;
+
+    MPI_Init(&argc,&argv);
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+
+    int batch = DEFAULT_BATCH; // how many candidates a stage sends to the next one per message
+    if(argc > 1){
+        n = atoll(argv[1]);
+    }
+    if(argc > 2){
+        batch = atoi(argv[2]);
+    }
+    const char* output = "primes.bin"; // where the pipeline writes the primes it finds
+    if(argc > 3){
+        output = argv[3];
+    }
+    if(batch < 1){
+        batch = 1;
+    }
+
+    // the sieving primes only go up to sqrt(n), so every rank can build them itself
+    int total_primes;
+    int* sieving_primes = sieve_small_primes((int)isqrt(n), &total_primes);
+
+    if(rank == 0){
+
+        sequential_start = MPI_Wtime();
+        int threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+        sequential_count = count_primes_segmented(2, n + 1, sieving_primes, total_primes);
+        omp_set_num_threads(threads);
+        sequential_end = MPI_Wtime();
+        sequential_time = sequential_end - sequential_start;
+    }
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        sieve_start = MPI_Wtime();
+        sieve_count = hybrid_sieve(n, rank, size, sieving_primes, total_primes);
+        MPI_Barrier(MPI_COMM_WORLD);
+        sieve_end = MPI_Wtime();
+        sieve_time = sieve_end - sieve_start;
+
+        // parallel implementation
+        // the pipeline passes candidates around as int, so it only runs when n fits in one
+        int pipeline_ran = 0;
+        MPI_Barrier(MPI_COMM_WORLD);
+        parallel_start = MPI_Wtime();
+        if(n <= INT_MAX){
+            run_pipeline((int)n, rank, size, sieving_primes, total_primes, batch, output, &pipeline_count);
+            pipeline_ran = 1;
+        }
+        else if(rank == 0){
+            printf("n = %lld does not fit in an int, skipping the pipelined approach\n", n);
         }
         MPI_Barrier(MPI_COMM_WORLD);
         parallel_end = MPI_Wtime();
         parallel_time = parallel_end-parallel_start;
         if (rank==0){
             printf("\n");
-            printf("###Parallel Results###\n");
-            printf("The time taken on pipelined approach is %f \n",parallel_time);
             printf("###Seq Results###\n");
+            printf("The number of primes up to %lld is %lld \n",n,sequential_count);
             printf("The time taken on Seq approach is %f \n",sequential_time);
-             float speed_up =  sequential_time/parallel_time;
-            printf("The speedup factor is %f \n",speed_up);
-            printf("The efficiency is %f",(float)(speed_up/size)*100);
+            printf("###Hybrid Sieve Results###\n");
+            printf("The number of primes up to %lld is %lld \n",n,sieve_count);
+            printf("The time taken on hybrid segmented sieve is %f \n",sieve_time);
+            float sieve_speed_up = sequential_time/sieve_time;
+            printf("The speedup factor is %f \n",sieve_speed_up);
+            printf("The efficiency is %f\n",(float)(sieve_speed_up/(size*omp_get_max_threads()))*100);
+            if(pipeline_ran){
+                printf("###Parallel Results###\n");
+                printf("The number of primes up to %lld is %lld (batches of %d), written to %s\n",n,pipeline_count + total_primes,batch,output);
+                printf("The time taken on pipelined approach is %f \n",parallel_time);
+                float speed_up =  sequential_time/parallel_time;
+                printf("The speedup factor is %f \n",speed_up);
+                printf("The efficiency is %f",(float)(speed_up/size)*100);
+            }
 
         }
 
-        free(primes_to_send);
+        free(sieving_primes);
         MPI_Finalize();
-        
-        
 
-
-        
-
-        
         return 0;
-        
-}
\ No newline at end of file
+
+}
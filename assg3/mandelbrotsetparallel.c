@@ -2,21 +2,328 @@
 #include <time.h>
 #include <omp.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <immintrin.h>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 #define WIDTH 640
 #define HEIGHT 480
 #define MAX_ITER 255
+#define TILE 32          // the accelerated renderer works on TILE x TILE tiles, one task each
+#define MIN_TILE 4       // below this the tile interior is computed pixel by pixel
+#define PERIOD_EPS 1e-12 // an orbit that comes back this close to a saved point is taken as periodic
+#define VERIFY_PIXELS (4L << 20) // images up to this many pixels are checked against the scalar path
+
+// the SIMD kernels have to do exactly the same multiplies and adds as cal_pixel to give the same image,
+// so none of the kernels may fuse them into FMAs
+#define NO_FMA __attribute__((optimize("fp-contract=off")))
 
 struct complex{
   double real;
   double imag;
 };
 
+// what to render, WIDTH, HEIGHT and MAX_ITER are only the defaults
+// pixel (i, j) is the point center + ((j - width/2) * span / width, (i - height/2) * span / height)
+struct view{
+  int width;
+  int height;
+  int max_iter;
+  double center_real;
+  double center_imag;
+  double span; // 4 / zoom
+};
+
+
+NO_FMA int cal_pixel(struct complex c, int max_iter) {
+
+
+            double z_real = 0;
+            double z_imag = 0;
+
+            double z_real2, z_imag2, lengthsq;
+
+            int iter = 0;
+            do {
+                z_real2 = z_real * z_real;
+                z_imag2 = z_imag * z_imag;
+
+                z_imag = 2 * z_real * z_imag + c.imag;
+                z_real = z_real2 - z_imag2 + c.real;
+                lengthsq =  z_real2 + z_imag2;
+                iter++;
+            }
+            while ((iter < max_iter) && (lengthsq < 4.0));
+
+            return iter;
+
+}
+
+// same as cal_pixel in single precision, good enough for shallow zooms and twice as many lanes per vector
+NO_FMA int cal_pixel_float(float c_real, float c_imag, int max_iter) {
+
+            float z_real = 0;
+            float z_imag = 0;
+
+            float z_real2, z_imag2, lengthsq;
+
+            int iter = 0;
+            do {
+                z_real2 = z_real * z_real;
+                z_imag2 = z_imag * z_imag;
+
+                z_imag = 2 * z_real * z_imag + c_imag;
+                z_real = z_real2 - z_imag2 + c_real;
+                lengthsq =  z_real2 + z_imag2;
+                iter++;
+            }
+            while ((iter < max_iter) && (lengthsq < 4.0f));
+
+            return iter;
+
+}
+
+NO_FMA double pixel_real(const struct view* v, int j) {
+    return v->center_real + (j - v->width / 2.0) * v->span / v->width;
+}
+
+NO_FMA double pixel_imag(const struct view* v, int i) {
+    return v->center_imag + (i - v->height / 2.0) * v->span / v->height;
+}
+
+struct complex pixel_point(const struct view* v, int i, int j) {
+    struct complex c;
+    c.real = pixel_real(v, j);
+    c.imag = pixel_imag(v, i);
+    return c;
+}
+
+// where a row kernel puts the escape counts of a row: straight into the row of the band, as ints (P2 and the
+// check against the scalar path) or as P5 pixels of 1 or 2 bytes, most significant first, capped at maxval
+struct pixel_row{
+    unsigned char* dst;
+    int bpp;
+    int maxval;
+};
+
+static inline void put_pixel(const struct pixel_row* row, int j, int count) {
+    if (row->bpp == (int)sizeof(int)) {
+        memcpy(row->dst + sizeof(int) * j, &count, sizeof(int));
+        return;
+    }
+    int value = count < row->maxval ? count : row->maxval;
+    if (row->bpp == 1) {
+        row->dst[j] = (unsigned char)value;
+    }
+    else {
+        row->dst[2*j] = (unsigned char)(value >> 8);
+        row->dst[2*j+1] = (unsigned char)(value & 0xFF);
+    }
+}
+
+// the vector kernels hand over one vector of counts at a time
+static inline void put_pixels(const struct pixel_row* row, int j, const int* counts, int n) {
+    for (int k = 0; k < n; k++) {
+        put_pixel(row, j + k, counts[k]);
+    }
+}
+
+// every row kernel fills pixels 0..width-1 of image row i
+void cal_row(const struct view* v, int i, const struct pixel_row* row) {
+    for (int j = 0; j < v->width; j++) {
+        put_pixel(row, j, cal_pixel(pixel_point(v, i, j), v->max_iter));
+    }
+}
+
+void cal_row_float(const struct view* v, int i, const struct pixel_row* row) {
+    float c_imag = (float)pixel_imag(v, i);
+    for (int j = 0; j < v->width; j++) {
+        put_pixel(row, j, cal_pixel_float((float)pixel_real(v, j), c_imag, v->max_iter));
+    }
+}
+
+// 4 points in lockstep, a lane stops counting once it escapes and the loop ends when no lane is left
+__attribute__((target("avx2"))) NO_FMA void cal_row_avx2(const struct view* v, int i, const struct pixel_row* row) {
+    __m256d c_imag = _mm256_set1_pd(pixel_imag(v, i));
+    __m256d half = _mm256_set1_pd(v->width / 2.0), span = _mm256_set1_pd(v->span), w = _mm256_set1_pd(v->width);
+    __m256d center = _mm256_set1_pd(v->center_real), max_iter = _mm256_set1_pd(v->max_iter);
+    int j = 0;
+    for (; j + 4 <= v->width; j += 4) {
+        __m256d jj = _mm256_set_pd(j + 3, j + 2, j + 1, j);
+        __m256d c_real = _mm256_add_pd(center, _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(jj, half), span), w));
+        __m256d z_real = _mm256_setzero_pd(), z_imag = _mm256_setzero_pd();
+        __m256d iter = _mm256_setzero_pd();
+        __m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        do {
+            __m256d z_real2 = _mm256_mul_pd(z_real, z_real);
+            __m256d z_imag2 = _mm256_mul_pd(z_imag, z_imag);
+            __m256d new_imag = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), z_real), z_imag), c_imag);
+            __m256d new_real = _mm256_add_pd(_mm256_sub_pd(z_real2, z_imag2), c_real);
+            __m256d lengthsq = _mm256_add_pd(z_real2, z_imag2);
+            z_imag = _mm256_blendv_pd(z_imag, new_imag, active);
+            z_real = _mm256_blendv_pd(z_real, new_real, active);
+            iter = _mm256_add_pd(iter, _mm256_and_pd(active, _mm256_set1_pd(1.0)));
+            active = _mm256_and_pd(active, _mm256_and_pd(_mm256_cmp_pd(iter, max_iter, _CMP_LT_OQ),
+                                                         _mm256_cmp_pd(lengthsq, _mm256_set1_pd(4.0), _CMP_LT_OQ)));
+        } while (_mm256_movemask_pd(active));
+        int counts[4];
+        _mm_storeu_si128((__m128i*)counts, _mm256_cvtpd_epi32(iter));
+        put_pixels(row, j, counts, 4);
+    }
+    for (; j < v->width; j++) {
+        put_pixel(row, j, cal_pixel(pixel_point(v, i, j), v->max_iter));
+    }
+}
+
+__attribute__((target("avx2"))) NO_FMA void cal_row_float_avx2(const struct view* v, int i, const struct pixel_row* row) {
+    __m256 c_imag = _mm256_set1_ps((float)pixel_imag(v, i));
+    __m256d half = _mm256_set1_pd(v->width / 2.0), span = _mm256_set1_pd(v->span), w = _mm256_set1_pd(v->width);
+    __m256d center = _mm256_set1_pd(v->center_real);
+    __m256 max_iter = _mm256_set1_ps(v->max_iter);
+    int j = 0;
+    for (; j + 8 <= v->width; j += 8) {
+        __m256d lo = _mm256_set_pd(j + 3, j + 2, j + 1, j);
+        __m256d hi = _mm256_add_pd(lo, _mm256_set1_pd(4.0));
+        lo = _mm256_add_pd(center, _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(lo, half), span), w));
+        hi = _mm256_add_pd(center, _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(hi, half), span), w));
+        __m256 c_real = _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+        __m256 z_real = _mm256_setzero_ps(), z_imag = _mm256_setzero_ps();
+        __m256 iter = _mm256_setzero_ps();
+        __m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        do {
+            __m256 z_real2 = _mm256_mul_ps(z_real, z_real);
+            __m256 z_imag2 = _mm256_mul_ps(z_imag, z_imag);
+            __m256 new_imag = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), z_real), z_imag), c_imag);
+            __m256 new_real = _mm256_add_ps(_mm256_sub_ps(z_real2, z_imag2), c_real);
+            __m256 lengthsq = _mm256_add_ps(z_real2, z_imag2);
+            z_imag = _mm256_blendv_ps(z_imag, new_imag, active);
+            z_real = _mm256_blendv_ps(z_real, new_real, active);
+            iter = _mm256_add_ps(iter, _mm256_and_ps(active, _mm256_set1_ps(1.0f)));
+            active = _mm256_and_ps(active, _mm256_and_ps(_mm256_cmp_ps(iter, max_iter, _CMP_LT_OQ),
+                                                         _mm256_cmp_ps(lengthsq, _mm256_set1_ps(4.0f), _CMP_LT_OQ)));
+        } while (_mm256_movemask_ps(active));
+        int counts[8];
+        _mm256_storeu_si256((__m256i*)counts, _mm256_cvtps_epi32(iter));
+        put_pixels(row, j, counts, 8);
+    }
+    for (; j < v->width; j++) {
+        put_pixel(row, j, cal_pixel_float((float)pixel_real(v, j), (float)pixel_imag(v, i), v->max_iter));
+    }
+}
+
+// 8 points in lockstep, with AVX-512 the lanes live in a mask register
+__attribute__((target("avx512f"))) NO_FMA void cal_row_avx512(const struct view* v, int i, const struct pixel_row* row) {
+    __m512d c_imag = _mm512_set1_pd(pixel_imag(v, i));
+    __m512d half = _mm512_set1_pd(v->width / 2.0), span = _mm512_set1_pd(v->span), w = _mm512_set1_pd(v->width);
+    __m512d center = _mm512_set1_pd(v->center_real), max_iter = _mm512_set1_pd(v->max_iter);
+    int j = 0;
+    for (; j + 8 <= v->width; j += 8) {
+        __m512d jj = _mm512_set_pd(j + 7, j + 6, j + 5, j + 4, j + 3, j + 2, j + 1, j);
+        __m512d c_real = _mm512_add_pd(center, _mm512_div_pd(_mm512_mul_pd(_mm512_sub_pd(jj, half), span), w));
+        __m512d z_real = _mm512_setzero_pd(), z_imag = _mm512_setzero_pd();
+        __m512d iter = _mm512_setzero_pd();
+        __mmask8 active = 0xFF;
+        do {
+            __m512d z_real2 = _mm512_mul_pd(z_real, z_real);
+            __m512d z_imag2 = _mm512_mul_pd(z_imag, z_imag);
+            __m512d new_imag = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(2.0), z_real), z_imag), c_imag);
+            __m512d new_real = _mm512_add_pd(_mm512_sub_pd(z_real2, z_imag2), c_real);
+            __m512d lengthsq = _mm512_add_pd(z_real2, z_imag2);
+            z_imag = _mm512_mask_mov_pd(z_imag, active, new_imag);
+            z_real = _mm512_mask_mov_pd(z_real, active, new_real);
+            iter = _mm512_mask_add_pd(iter, active, iter, _mm512_set1_pd(1.0));
+            active = _mm512_mask_cmp_pd_mask(active, iter, max_iter, _CMP_LT_OQ)
+                   & _mm512_cmp_pd_mask(lengthsq, _mm512_set1_pd(4.0), _CMP_LT_OQ);
+        } while (active);
+        int counts[8];
+        _mm256_storeu_si256((__m256i*)counts, _mm512_cvtpd_epi32(iter));
+        put_pixels(row, j, counts, 8);
+    }
+    for (; j < v->width; j++) {
+        put_pixel(row, j, cal_pixel(pixel_point(v, i, j), v->max_iter));
+    }
+}
+
+__attribute__((target("avx512f"))) NO_FMA void cal_row_float_avx512(const struct view* v, int i, const struct pixel_row* row) {
+    __m512 c_imag = _mm512_set1_ps((float)pixel_imag(v, i));
+    __m512d half = _mm512_set1_pd(v->width / 2.0), span = _mm512_set1_pd(v->span), w = _mm512_set1_pd(v->width);
+    __m512d center = _mm512_set1_pd(v->center_real);
+    __m512 max_iter = _mm512_set1_ps(v->max_iter);
+    int j = 0;
+    for (; j + 16 <= v->width; j += 16) {
+        __m512d lo = _mm512_set_pd(j + 7, j + 6, j + 5, j + 4, j + 3, j + 2, j + 1, j);
+        __m512d hi = _mm512_add_pd(lo, _mm512_set1_pd(8.0));
+        lo = _mm512_add_pd(center, _mm512_div_pd(_mm512_mul_pd(_mm512_sub_pd(lo, half), span), w));
+        hi = _mm512_add_pd(center, _mm512_div_pd(_mm512_mul_pd(_mm512_sub_pd(hi, half), span), w));
+        __m512 c_real = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(lo))),
+                                                            _mm256_castps_pd(_mm512_cvtpd_ps(hi)), 1));
+        __m512 z_real = _mm512_setzero_ps(), z_imag = _mm512_setzero_ps();
+        __m512 iter = _mm512_setzero_ps();
+        __mmask16 active = 0xFFFF;
+        do {
+            __m512 z_real2 = _mm512_mul_ps(z_real, z_real);
+            __m512 z_imag2 = _mm512_mul_ps(z_imag, z_imag);
+            __m512 new_imag = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), z_real), z_imag), c_imag);
+            __m512 new_real = _mm512_add_ps(_mm512_sub_ps(z_real2, z_imag2), c_real);
+            __m512 lengthsq = _mm512_add_ps(z_real2, z_imag2);
+            z_imag = _mm512_mask_mov_ps(z_imag, active, new_imag);
+            z_real = _mm512_mask_mov_ps(z_real, active, new_real);
+            iter = _mm512_mask_add_ps(iter, active, iter, _mm512_set1_ps(1.0f));
+            active = _mm512_mask_cmp_ps_mask(active, iter, max_iter, _CMP_LT_OQ)
+                   & _mm512_cmp_ps_mask(lengthsq, _mm512_set1_ps(4.0f), _CMP_LT_OQ);
+        } while (active);
+        int counts[16];
+        _mm512_storeu_si512((void*)counts, _mm512_cvtps_epi32(iter));
+        put_pixels(row, j, counts, 16);
+    }
+    for (; j < v->width; j++) {
+        put_pixel(row, j, cal_pixel_float((float)pixel_real(v, j), (float)pixel_imag(v, i), v->max_iter));
+    }
+}
 
-int cal_pixel(struct complex c) {
-    
+typedef void (*row_kernel_t)(const struct view*, int, const struct pixel_row*);
+
+// picks the widest row kernel the CPU running us supports, mode is "scalar", "simd" or "float"
+// *reference gets the scalar kernel the result has to match
+row_kernel_t select_row_kernel(const char* mode, row_kernel_t* reference, const char** name) {
+    __builtin_cpu_init();
+    int is_float = strcmp(mode, "float") == 0;
+    *reference = is_float ? cal_row_float : cal_row;
+    if (strcmp(mode, "scalar") == 0) {
+        *name = "scalar";
+        return cal_row;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        *name = is_float ? "float avx512 (16 lanes)" : "avx512 (8 lanes)";
+        return is_float ? cal_row_float_avx512 : cal_row_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        *name = is_float ? "float avx2 (8 lanes)" : "avx2 (4 lanes)";
+        return is_float ? cal_row_float_avx2 : cal_row_avx2;
+    }
+    *name = is_float ? "float scalar" : "scalar";
+    return *reference;
+}
+
+// cal_pixel that skips the points it can prove never escape, *work gets the iterations actually done
+NO_FMA int cal_pixel_accel(struct complex c, int max_iter, long* work) {
+
+            // main cardioid and period-2 bulb
+            double x = c.real - 0.25, y2 = c.imag * c.imag;
+            double q = x * x + y2;
+            if (q * (q + x) < 0.25 * y2 || (c.real + 1) * (c.real + 1) + y2 < 0.0625) {
+                return max_iter;
+            }
 
             double z_real = 0;
             double z_imag = 0;
+            double saved_real = 0, saved_imag = 0; // Brent's cycle detection, the saved point moves after 8, 16, 32, ... steps
+            int steps = 0, period = 8;
 
             double z_real2, z_imag2, lengthsq;
 
@@ -29,68 +336,776 @@ int cal_pixel(struct complex c) {
                 z_real = z_real2 - z_imag2 + c.real;
                 lengthsq =  z_real2 + z_imag2;
                 iter++;
+
+                if (fabs(z_real - saved_real) < PERIOD_EPS && fabs(z_imag - saved_imag) < PERIOD_EPS) {
+                    *work += iter;
+                    return max_iter;
+                }
+                if (++steps == period) {
+                    steps = 0;
+                    period *= 2;
+                    saved_real = z_real;
+                    saved_imag = z_imag;
+                }
+            }
+            while ((iter < max_iter) && (lengthsq < 4.0));
+
+            *work += iter;
+            return iter;
+
+}
+
+// Mariani-Silver on the rectangle rows y0..y1, columns x0..x1 of a band starting at image row b0, whose border is already computed
+// a border of one value means the whole inside has that value, otherwise the rectangle is cut in four
+void mariani_silver(const struct view* v, int* band, int b0, int y0, int x0, int y1, int x1, long* work) {
+    int i, j, w = v->width;
+    long local_work = 0;
+    if (y1 - y0 < 2 || x1 - x0 < 2) {
+        return; // no inside left
+    }
+
+    int value = band[(long)y0*w + x0], uniform = 1;
+    for (j = x0; j <= x1 && uniform; j++) {
+        uniform = band[(long)y0*w + j] == value && band[(long)y1*w + j] == value;
+    }
+    for (i = y0; i <= y1 && uniform; i++) {
+        uniform = band[(long)i*w + x0] == value && band[(long)i*w + x1] == value;
+    }
+
+    if (uniform) {
+        for (i = y0 + 1; i < y1; i++) {
+            for (j = x0 + 1; j < x1; j++) {
+                band[(long)i*w + j] = value;
+            }
+        }
+        return;
+    }
+
+    if (y1 - y0 <= MIN_TILE || x1 - x0 <= MIN_TILE) {
+        for (i = y0 + 1; i < y1; i++) {
+            for (j = x0 + 1; j < x1; j++) {
+                band[(long)i*w + j] = cal_pixel_accel(pixel_point(v, b0 + i, j), v->max_iter, &local_work);
+            }
+        }
+        #pragma omp atomic
+        *work += local_work;
+        return;
+    }
+
+    // the cross through the middle becomes the shared border of the four quarters
+    int ym = (y0 + y1) / 2, xm = (x0 + x1) / 2;
+    for (j = x0 + 1; j < x1; j++) {
+        band[(long)ym*w + j] = cal_pixel_accel(pixel_point(v, b0 + ym, j), v->max_iter, &local_work);
+    }
+    for (i = y0 + 1; i < y1; i++) {
+        if (i != ym) band[(long)i*w + xm] = cal_pixel_accel(pixel_point(v, b0 + i, xm), v->max_iter, &local_work);
+    }
+    #pragma omp atomic
+    *work += local_work;
+
+    #pragma omp task
+    mariani_silver(v, band, b0, y0, x0, ym, xm, work);
+    #pragma omp task
+    mariani_silver(v, band, b0, y0, xm, ym, x1, work);
+    #pragma omp task
+    mariani_silver(v, band, b0, ym, x0, y1, xm, work);
+    mariani_silver(v, band, b0, ym, xm, y1, x1, work);
+    #pragma omp taskwait
+}
+
+// renders rows b0..b0+rows-1 with the cardioid/bulb test, cycle detection and Mariani-Silver, returns the iterations done
+long render_accel(const struct view* v, int* band, int b0, int rows) {
+    long work = 0;
+    int i, w = v->width;
+
+    // grid lines every TILE rows and columns of the band, they are the borders of the tiles
+    #pragma omp parallel for schedule(dynamic) reduction(+:work)
+    for (i = 0; i < rows; i++) {
+        for (int j = 0; j < w; j++) {
+            if (i % TILE == 0 || i == rows - 1 || j % TILE == 0 || j == w - 1) {
+                band[(long)i*w + j] = cal_pixel_accel(pixel_point(v, b0 + i, j), v->max_iter, &work);
+            }
+        }
+    }
+
+    #pragma omp parallel
+    #pragma omp single
+    for (int y = 0; y < rows - 1; y += TILE) {
+        for (int x = 0; x < w - 1; x += TILE) {
+            #pragma omp task
+            mariani_silver(v, band, b0, y, x, y + TILE < rows - 1 ? y + TILE : rows - 1, x + TILE < w - 1 ? x + TILE : w - 1, &work);
+        }
+    }
+
+    return work;
+}
+
+// deep zoom by perturbation: one reference orbit Z_n at the view center is computed in fixed point with as many
+// bits as the zoom needs, every pixel then only iterates its difference dz_n = z_n - Z_n in doubles,
+//     dz_{n+1} = (2 Z_n + dz_n) dz_n + dc
+// pixel spacing down to about 1e-300 works, below that the deltas underflow a double
+#define MP_LIMBS 40      // up to 1248 fraction bits for the reference orbit
+#define SA_TOL 1e-12     // series approximation error allowed, as a fraction of a pixel
+
+// fixed point number, d[0] is the least significant limb and d[mp_n-1] the integer part
+struct mp{
+    int neg;
+    uint32_t d[MP_LIMBS];
+};
+
+int mp_n = 4; // limbs in use, set from the zoom
+
+int mp_cmp_mag(const struct mp* a, const struct mp* b) {
+    for (int k = mp_n - 1; k >= 0; k--) {
+        if (a->d[k] != b->d[k]) return a->d[k] < b->d[k] ? -1 : 1;
+    }
+    return 0;
+}
+
+void mp_add(struct mp* r, const struct mp* a, const struct mp* b) {
+    struct mp t;
+    uint64_t carry = 0;
+    if (a->neg == b->neg) {
+        for (int k = 0; k < mp_n; k++) {
+            carry += (uint64_t)a->d[k] + b->d[k];
+            t.d[k] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        t.neg = a->neg;
+    }
+    else {
+        // |a| - |b| or |b| - |a|, the sign is that of the larger one
+        if (mp_cmp_mag(a, b) < 0) {
+            const struct mp* swap = a;
+            a = b;
+            b = swap;
+        }
+        int64_t borrow = 0;
+        for (int k = 0; k < mp_n; k++) {
+            borrow += (int64_t)a->d[k] - b->d[k];
+            t.d[k] = (uint32_t)borrow;
+            borrow >>= 32;
+        }
+        t.neg = a->neg;
+    }
+    *r = t;
+}
+
+void mp_sub(struct mp* r, const struct mp* a, const struct mp* b) {
+    struct mp negated = *b;
+    negated.neg = !b->neg;
+    mp_add(r, a, &negated);
+}
+
+// schoolbook product, the limbs below the last fraction limb are dropped
+void mp_mul(struct mp* r, const struct mp* a, const struct mp* b) {
+    uint32_t product[2 * MP_LIMBS] = {0};
+    for (int i = 0; i < mp_n; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < mp_n; j++) {
+            carry += (uint64_t)a->d[i] * b->d[j] + product[i + j];
+            product[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        product[i + mp_n] = (uint32_t)carry;
+    }
+    r->neg = a->neg != b->neg;
+    memcpy(r->d, product + mp_n - 1, sizeof(uint32_t) * mp_n);
+}
+
+double mp_to_double(const struct mp* a) {
+    double x = 0;
+    for (int k = mp_n - 1; k >= 0 && k >= mp_n - 3; k--) {
+        x += ldexp((double)a->d[k], 32 * (k - (mp_n - 1)));
+    }
+    return a->neg ? -x : x;
+}
+
+void mp_from_double(struct mp* r, double x) {
+    memset(r, 0, sizeof(*r));
+    r->neg = x < 0;
+    x = fabs(x);
+    for (int k = mp_n - 1; k >= 0; k--) {
+        r->d[k] = (uint32_t)floor(x);
+        x = ldexp(x - floor(x), 32);
+    }
+}
+
+// decimal string such as -1.7490234375000000000000001, with all its digits, anything with an exponent goes through a double
+void mp_from_string(struct mp* r, const char* s) {
+    if (strpbrk(s, "eE")) {
+        mp_from_double(r, atof(s));
+        return;
+    }
+    memset(r, 0, sizeof(*r));
+    int neg = *s == '-';
+    if (*s == '-' || *s == '+') s++;
+    uint32_t integer = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+        integer = integer * 10 + (*s - '0');
+    }
+    if (*s == '.') {
+        const char* last = ++s;
+        while (*last >= '0' && *last <= '9') last++;
+        // from the last digit up: frac = (digit + frac) / 10
+        while (last-- > s) {
+            uint64_t rem = 0;
+            r->d[mp_n - 1] = *last - '0';
+            for (int k = mp_n - 1; k >= 0; k--) {
+                rem = rem << 32 | r->d[k];
+                r->d[k] = (uint32_t)(rem / 10);
+                rem %= 10;
             }
-            while ((iter < MAX_ITER) && (lengthsq < 4.0));
+        }
+    }
+    r->d[mp_n - 1] = integer;
+    r->neg = neg;
+}
+
+// the reference orbit at the view center and the series dz_skip = A dc + B dc^2 + C dc^3
+// that lets every pixel start at iteration skip
+struct deep_reference{
+    int len;        // Z_0 .. Z_{len-1}, the last one may have escaped
+    int skip;
+    double* z_real;
+    double* z_imag;
+    struct complex a, b, c;
+};
+
+struct deep_reference deep_ref;
+
+struct complex cmul(struct complex x, struct complex y) {
+    struct complex r = {x.real * y.real - x.imag * y.imag, x.real * y.imag + x.imag * y.real};
+    return r;
+}
+
+double cabs2(struct complex x) {
+    return x.real * x.real + x.imag * x.imag;
+}
+
+void build_deep_reference(const struct view* v, const char* center_real, const char* center_imag) {
+    double step = fmax(v->span / v->width, v->span / v->height);
+    // enough fraction bits to tell pixels apart, and 64 more for the orbit to lose on the way
+    mp_n = 2 + (int)ceil((64 - log2(step)) / 32);
+    if (mp_n > MP_LIMBS) mp_n = MP_LIMBS;
+    struct mp c_real, c_imag, z_real, z_imag, z_real2, z_imag2, z_cross;
+    mp_from_string(&c_real, center_real);
+    mp_from_string(&c_imag, center_imag);
+    mp_from_double(&z_real, 0);
+    mp_from_double(&z_imag, 0);
+
+    deep_ref.z_real = malloc(sizeof(double) * (v->max_iter + 1));
+    deep_ref.z_imag = malloc(sizeof(double) * (v->max_iter + 1));
+    int n = 0;
+    while (1) {
+        double zr = mp_to_double(&z_real), zi = mp_to_double(&z_imag);
+        deep_ref.z_real[n] = zr;
+        deep_ref.z_imag[n] = zi;
+        n++;
+        if (n > v->max_iter || zr * zr + zi * zi >= 4.0) break;
+        mp_mul(&z_real2, &z_real, &z_real);
+        mp_mul(&z_imag2, &z_imag, &z_imag);
+        mp_mul(&z_cross, &z_real, &z_imag);
+        mp_sub(&z_real, &z_real2, &z_imag2);
+        mp_add(&z_real, &z_real, &c_real);
+        mp_add(&z_imag, &z_cross, &z_cross);
+        mp_add(&z_imag, &z_imag, &c_imag);
+    }
+    deep_ref.len = n;
 
+    // A_{n+1} = 2 Z_n A_n + 1, B_{n+1} = 2 Z_n B_n + A_n^2, C_{n+1} = 2 Z_n C_n + 2 A_n B_n
+    // they are good while the first dropped term, D_{n+1} = 2 Z_n D_n + 2 A_n C_n + B_n^2 at dc^4,
+    // stays below SA_TOL of a pixel for the corner pixels,
+    // and they may only skip iterations where no pixel can have escaped yet
+    double radius = hypot(v->span / 2, v->span / 2);
+    struct complex a = {0, 0}, b = {0, 0}, c = {0, 0}, d = {0, 0};
+    deep_ref.skip = 0;
+    deep_ref.a = a;
+    deep_ref.b = b;
+    deep_ref.c = c;
+    for (n = 0; n + 1 < deep_ref.len && n + 1 < v->max_iter; n++) {
+        struct complex z2 = {2 * deep_ref.z_real[n], 2 * deep_ref.z_imag[n]};
+        double reach = sqrt(cabs2(a)) * radius + sqrt(cabs2(b)) * radius * radius + sqrt(cabs2(c)) * radius * radius * radius;
+        if (sqrt(cabs2(z2)) / 2 + reach >= 2.0) break;
+        struct complex next_a = cmul(z2, a), next_b = cmul(z2, b), next_c = cmul(z2, c), next_d = cmul(z2, d);
+        struct complex ab = cmul(a, b), aa = cmul(a, a), ac = cmul(a, c), bb = cmul(b, b);
+        next_a.real += 1;
+        next_b.real += aa.real;
+        next_b.imag += aa.imag;
+        next_c.real += 2 * ab.real;
+        next_c.imag += 2 * ab.imag;
+        next_d.real += 2 * ac.real + bb.real;
+        next_d.imag += 2 * ac.imag + bb.imag;
+        a = next_a;
+        b = next_b;
+        c = next_c;
+        d = next_d;
+        double error = sqrt(cabs2(d)) * radius * radius * radius * radius;
+        if (!isfinite(error) || error > SA_TOL * sqrt(cabs2(a)) * step) break;
+        deep_ref.skip = n + 1;
+        deep_ref.a = a;
+        deep_ref.b = b;
+        deep_ref.c = c;
+    }
+}
+
+void free_deep_reference(void) {
+    free(deep_ref.z_real);
+    free(deep_ref.z_imag);
+}
+
+// the result matches cal_pixel, the count includes the iteration whose |z| reaches 2
+// when |z_n| drops below |dz_n| (a glitch, dz has lost the digits that matter) or the reference runs out,
+// the pixel is rebased onto the start of the reference orbit: dz = z, since Z_0 = 0
+int cal_pixel_deep(struct complex dc, int max_iter) {
+    const double* ref_real = deep_ref.z_real;
+    const double* ref_imag = deep_ref.z_imag;
+    struct complex dc2 = cmul(dc, dc), dc3 = cmul(dc2, dc);
+    struct complex a = cmul(deep_ref.a, dc), b = cmul(deep_ref.b, dc2), c = cmul(deep_ref.c, dc3);
+    double dz_real = a.real + b.real + c.real;
+    double dz_imag = a.imag + b.imag + c.imag;
+    int iter = deep_ref.skip; // index of the current z
+    int m = deep_ref.skip;    // where on the reference orbit
+    while (1) {
+        double z_real = ref_real[m] + dz_real;
+        double z_imag = ref_imag[m] + dz_imag;
+        double lengthsq = z_real * z_real + z_imag * z_imag;
+        iter++;
+        if (iter >= max_iter || lengthsq >= 4.0) {
             return iter;
+        }
+        if (lengthsq < dz_real * dz_real + dz_imag * dz_imag || m == deep_ref.len - 1) {
+            dz_real = z_real;
+            dz_imag = z_imag;
+            m = 0;
+        }
+        double two_real = 2 * ref_real[m] + dz_real;
+        double two_imag = 2 * ref_imag[m] + dz_imag;
+        double new_real = two_real * dz_real - two_imag * dz_imag + dc.real;
+        dz_imag = two_real * dz_imag + two_imag * dz_real + dc.imag;
+        dz_real = new_real;
+        m++;
+    }
+}
+
+void cal_row_deep(const struct view* v, int i, const struct pixel_row* row) {
+    struct complex dc;
+    dc.imag = (i - v->height / 2.0) * v->span / v->height;
+    for (int j = 0; j < v->width; j++) {
+        dc.real = (j - v->width / 2.0) * v->span / v->width;
+        put_pixel(row, j, cal_pixel_deep(dc, v->max_iter));
+    }
+}
+
+// where the rendered rows go, P5 stores 1 byte per pixel (2 bytes, most significant first, when maxval > 255)
+// and every row lands at a known offset, so each thread pwrites its own rows straight from the band
+// P2 keeps an int per pixel in the band and prints the rows in order
+struct pgm_out{
+    int binary;
+    int bpp;     // bytes per pixel in the band
+    int maxval;
+    int fd;      // P5, -1 while nothing is written
+    FILE* file;  // P2, NULL while nothing is written
+    long header; // bytes before the first pixel
+};
+
+void init_pgm_out(struct pgm_out* out, const struct view* v, int binary) {
+    out->binary = binary;
+    out->maxval = v->max_iter < 65535 ? v->max_iter : 65535;
+    out->bpp = !binary ? (int)sizeof(int) : out->maxval > 255 ? 2 : 1;
+    out->fd = -1;
+    out->file = NULL;
+    out->header = 0;
+}
+
+// the row of the band that image row i of a band goes to
+struct pixel_row band_row(unsigned char* band, int i, int width, const struct pgm_out* out) {
+    struct pixel_row row = {band + (long)i * width * out->bpp, out->bpp, out->maxval};
+    return row;
+}
 
+// narrows a row of iteration counts from the accelerated renderer into the band format
+void store_row(const int* counts, const struct pixel_row* row, int width) {
+    put_pixels(row, 0, counts, width);
 }
 
-void save_pgm(const char *filename, int image[HEIGHT][WIDTH]) {
-    FILE* pgmimg; 
+int load_pixel(const unsigned char* band, long idx, const struct pgm_out* out) {
+    if (out->bpp == 1) return band[idx];
+    if (out->bpp == 2) return band[2*idx] << 8 | band[2*idx+1];
+    return ((const int*)band)[idx];
+}
+
+// pwrite can write less than asked for
+int write_at(int fd, const unsigned char* buf, long len, long offset) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, buf, len, offset);
+        if (written <= 0) {
+            return 1;
+        }
+        buf += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+void save_pgm_rows(FILE* pgmimg, const int* band, int rows, int width) {
     int temp;
-    pgmimg = fopen(filename, "wb"); 
-    fprintf(pgmimg, "P2\n"); // Writing Magic Number to the File   
-    fprintf(pgmimg, "%d %d\n", WIDTH, HEIGHT);  // Writing Width and Height
-    fprintf(pgmimg, "255\n");  // Writing the maximum gray value 
-    int count = 0; 
-    
-    for (int i = 0; i < HEIGHT; i++) { 
-        for (int j = 0; j < WIDTH; j++) { 
-            temp = image[i][j]; 
-            fprintf(pgmimg, "%d ", temp); // Writing the gray values in the 2D array to the file 
-        } 
-        fprintf(pgmimg, "\n"); 
-    } 
-    fclose(pgmimg); 
-} 
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < width; j++) {
+            temp = band[(long)i*width + j];
+            fprintf(pgmimg, "%d ", temp < 65535 ? temp : 65535); // Writing the gray values in the 2D array to the file
+        }
+        fprintf(pgmimg, "\n");
+    }
+}
+
+// renders rows b0..b0+rows-1 into pixels, with row_kernel or with the accelerated renderer when row_kernel is NULL
+// row kernels write their pixels straight into the band in its own format, and for P5 the thread that rendered a row writes it out
+long render_band(const struct view* v, row_kernel_t row_kernel, int* accel_band, unsigned char* pixels, const struct pgm_out* out, int b0, int rows) {
+    int i;
+    int chunk_size = 1; // since one row at a time
+    long work = 0;
+    long row_bytes = (long)v->width * out->bpp;
+    int failed = 0;
+    if (!row_kernel) {
+        work = render_accel(v, accel_band, b0, rows);
+    }
+    #pragma omp parallel for schedule(dynamic,chunk_size) reduction(|:failed) // dynamic since execution time varies at each iteration
+    for (i = 0; i < rows; i++) {
+        struct pixel_row row = band_row(pixels, i, v->width, out);
+        if (row_kernel) {
+            row_kernel(v, b0 + i, &row);
+        }
+        else {
+            store_row(accel_band + (long)i*v->width, &row, v->width);
+        }
+        if (out->fd >= 0) {
+            failed |= write_at(out->fd, row.dst, row_bytes, out->header + (long)(b0 + i)*row_bytes);
+        }
+    }
+    if (failed) {
+        printf("Writing rows %d..%d failed\n", b0, b0 + rows - 1);
+    }
+    if (out->file) {
+        save_pgm_rows(out->file, (const int*)pixels, rows, v->width);
+    }
+    return work;
+}
 
+int p5_header(char* header, int size, const struct view* v, const struct pgm_out* out) {
+    return snprintf(header, size, "P5\n%d %d\n%d\n", v->width, v->height, out->maxval);
+}
 
-int main(int argc, char** argv) {
-    
-    int threads_given;
+// the image is written band by band, so only the header goes out here
+int open_pgm(const char *filename, const struct view* v, struct pgm_out* out) {
+    if (out->binary) {
+        char header[64];
+        out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out->fd < 0) {
+            return 1;
+        }
+        out->header = p5_header(header, sizeof(header), v, out);
+        // the file gets its final size up front, the threads fill in the rows in whatever order they finish
+        if (write_at(out->fd, (const unsigned char*)header, out->header, 0)
+            || ftruncate(out->fd, out->header + (long)v->width * v->height * out->bpp)) {
+            close(out->fd);
+            return 1;
+        }
+        return 0;
+    }
+    FILE* pgmimg;
+    pgmimg = fopen(filename, "wb");
+    if (!pgmimg) {
+        return 1;
+    }
+    fprintf(pgmimg, "P2\n"); // Writing Magic Number to the File
+    fprintf(pgmimg, "%d %d\n", v->width, v->height);  // Writing Width and Height
+    fprintf(pgmimg, "%d\n", out->maxval);  // Writing the maximum gray value
+    out->file = pgmimg;
+    return 0;
+}
+
+void close_pgm(struct pgm_out* out) {
+    if (out->fd >= 0) close(out->fd);
+    if (out->file) fclose(out->file);
+    out->fd = -1;
+    out->file = NULL;
+}
+
+// the arguments both the OpenMP and the MPI renderer take, nonzero when they make no sense
+int parse_args(int argc, char** argv, int* threads, const char** mode, struct view* v, const char** output, int* trials, int* binary) {
     if(argc < 2){
         return 1;
     }
-    else{
-        threads_given = atoi(argv[1]);
+    *threads = atoi(argv[1]);
+    if(argc > 2) *mode = argv[2];
+    if(argc > 3) v->width = atoi(argv[3]);
+    if(argc > 4) v->height = atoi(argv[4]);
+    if(argc > 5) v->max_iter = atoi(argv[5]);
+    if(argc > 6) v->center_real = atof(argv[6]);
+    if(argc > 7) v->center_imag = atof(argv[7]);
+    if(argc > 8) v->span = 4.0 / atof(argv[8]);
+    if(argc > 9) *output = argv[9];
+    if(argc > 10) *trials = atoi(argv[10]);
+    if(argc > 11) *binary = strcmp(argv[11], "p2") != 0;
+    return *threads < 1 || v->width < 1 || v->height < 1 || v->max_iter < 1 || *trials < 0;
+}
+
+// picks what renders the rows for mode, NULL means the accelerated renderer
+row_kernel_t setup_renderer(const char* mode, const struct view* v, int argc, char** argv, row_kernel_t* reference, int verbose) {
+    const char* kernel_name;
+    *reference = cal_row;
+    if (strcmp(mode, "deep") == 0) {
+        // the center is read again from its digits, a double would round it to the pixel size of a 1e-16 zoom
+        build_deep_reference(v, argc > 6 ? argv[6] : "0", argc > 7 ? argv[7] : "0");
+        if (verbose) {
+            printf("Renderer: perturbation (reference orbit of %d iterations at %d bits, %d skipped by series approximation)\n",
+                   deep_ref.len - 1, 32 * (mp_n - 1), deep_ref.skip);
+        }
+        return cal_row_deep;
+    }
+    if (strcmp(mode, "accel") == 0) {
+        if (verbose) {
+            printf("Renderer: accelerated (cardioid/bulb test, cycle detection, Mariani-Silver)\n");
+        }
+        return NULL;
+    }
+    row_kernel_t row_kernel = select_row_kernel(mode, reference, &kernel_name);
+    if (verbose) {
+        printf("Row kernel: %s\n", kernel_name);
+    }
+    return row_kernel;
+}
+
+#ifdef USE_MPI
+// distributed renderer, built with mpicc -fopenmp -DUSE_MPI
+// rank 0 hands out strips of rows on demand and every other rank renders its strips with OpenMP threads,
+// a fixed split would leave ranks idle since a strip through the set costs up to max_iter per pixel and one outside almost nothing
+// every worker holds one strip in reserve, so asking for more never stalls it: it reports a strip done and goes
+// straight on with the reserve while the answer comes in
+// the finished strips go straight into the P5 file at their own offsets, the pixels never pass through rank 0
+#define STRIP_ROWS 4 // rows per thread in a strip
+#define TAG_STRIP 1
+#define TAG_DONE 2
+
+// rank 0, strip -1 tells a worker there is nothing left
+void dispatch_strips(int strips, int size) {
+    int next = 0, done = 0, strip;
+    int* stopped = calloc(size, sizeof(int));
+    MPI_Status status;
+    // two strips each to begin with, one to render and one to hold
+    for (int k = 0; k < 2; k++) {
+        for (int w = 1; w < size; w++) {
+            if (!stopped[w]) {
+                strip = next < strips ? next++ : -1;
+                MPI_Send(&strip, 1, MPI_INT, w, TAG_STRIP, MPI_COMM_WORLD);
+                stopped[w] = strip < 0;
+            }
+        }
+    }
+    // every report is answered with the strip after the reserve, a worker that already has its -1 gets nothing more
+    while (done < strips) {
+        MPI_Recv(&strip, 1, MPI_INT, MPI_ANY_SOURCE, TAG_DONE, MPI_COMM_WORLD, &status);
+        done++;
+        if (!stopped[status.MPI_SOURCE]) {
+            strip = next < strips ? next++ : -1;
+            MPI_Send(&strip, 1, MPI_INT, status.MPI_SOURCE, TAG_STRIP, MPI_COMM_WORLD);
+            stopped[status.MPI_SOURCE] = strip < 0;
+        }
+    }
+    free(stopped);
+}
+
+// the other ranks, the two bands take turns so a strip can be rendered while the one before is still being written
+// returns the seconds spent rendering, *strips_done counts the strips
+double work_strips(const struct view* v, row_kernel_t row_kernel, int* accel_band, unsigned char** bands, const struct pgm_out* out,
+                   MPI_File file, int strip_rows, int* strips_done) {
+    int current, next, b = 0;
+    long row_bytes = (long)v->width * out->bpp;
+    double busy = 0;
+    MPI_Request strip_request = MPI_REQUEST_NULL;
+    MPI_Request write_requests[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    MPI_Recv(&current, 1, MPI_INT, 0, TAG_STRIP, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (current >= 0) {
+        MPI_Irecv(&next, 1, MPI_INT, 0, TAG_STRIP, MPI_COMM_WORLD, &strip_request);
+    }
+    while (current >= 0) {
+        int b0 = current * strip_rows;
+        int rows = v->height - b0 < strip_rows ? v->height - b0 : strip_rows;
+        MPI_Wait(&write_requests[b], MPI_STATUS_IGNORE);
+        double start = MPI_Wtime();
+        render_band(v, row_kernel, accel_band, bands[b], out, b0, rows);
+        busy += MPI_Wtime() - start;
+        MPI_File_iwrite_at(file, out->header + b0 * row_bytes, bands[b], (int)(rows * row_bytes), MPI_BYTE, &write_requests[b]);
+        MPI_Send(&current, 1, MPI_INT, 0, TAG_DONE, MPI_COMM_WORLD);
+        (*strips_done)++;
+        MPI_Wait(&strip_request, MPI_STATUS_IGNORE); // the reserve, sent while this strip was rendering
+        current = next;
+        if (current >= 0) {
+            MPI_Irecv(&next, 1, MPI_INT, 0, TAG_STRIP, MPI_COMM_WORLD, &strip_request);
+        }
+        b ^= 1;
+    }
+    MPI_Waitall(2, write_requests, MPI_STATUSES_IGNORE);
+    return busy;
+}
+
+int mpi_main(int argc, char** argv) {
+    int rank, size;
+    int threads_given;
+    const char* mode = "simd";
+    const char* output = "mandelbrot.pgm";
+    struct view v = {WIDTH, HEIGHT, MAX_ITER, 0.0, 0.0, 4.0};
+    int N = 10; // number of frames
+    int binary = 1;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (parse_args(argc, argv, &threads_given, &mode, &v, &output, &N, &binary) || size < 2) {
+        if (rank == 0) printf("Needs threads and at least 2 ranks, rank 0 only hands out the strips\n");
+        MPI_Finalize();
+        return 1;
+    }
+    if (!binary && rank == 0) {
+        printf("P2 rows have no fixed offsets, writing P5\n");
+    }
+    if (N < 1) N = 1;
+
+    omp_set_num_threads(threads_given);
+    struct pgm_out out;
+    init_pgm_out(&out, &v, 1);
+    char header[64];
+    out.header = p5_header(header, sizeof(header), &v, &out);
+    int strip_rows = threads_given * STRIP_ROWS < v.height ? threads_given * STRIP_ROWS : v.height;
+    int strips = (v.height + strip_rows - 1) / strip_rows;
+    row_kernel_t reference;
+    row_kernel_t row_kernel = setup_renderer(mode, &v, argc, argv, &reference, rank == 0); // every rank builds its own deep reference
+    unsigned char* bands[2] = {NULL, NULL};
+    int* accel_band = NULL;
+    if (rank > 0) {
+        bands[0] = malloc((long)out.bpp * strip_rows * v.width);
+        bands[1] = malloc((long)out.bpp * strip_rows * v.width);
+        if (!row_kernel) {
+            accel_band = malloc(sizeof(int) * (long)strip_rows * v.width);
+        }
+    }
+    if (rank == 0) {
+        printf("Image: %dx%d, max_iter %d, center (%g, %g), span %g, %d strips of %d rows over %d workers, %s\n",
+               v.width, v.height, v.max_iter, v.center_real, v.center_imag, v.span, strips, strip_rows, size - 1,
+               out.bpp == 1 ? "P5 8-bit" : "P5 16-bit");
+    }
+
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, output, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) printf("Could not open %s\n", output);
+        MPI_Finalize();
+        return 1;
+    }
+    MPI_File_set_size(file, out.header + (MPI_Offset)v.width * v.height * out.bpp);
+    if (rank == 0) {
+        MPI_File_write_at(file, 0, header, (int)out.header, MPI_CHAR, MPI_STATUS_IGNORE);
     }
-    
+
+    // every frame renders and writes the whole image, the frame ends when the last strip is in the file
+    double AVG = 0, busy = 0;
+    int strips_done = 0;
+    for (int k = 0; k < N; k++) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start_time = MPI_Wtime();
+        if (rank == 0) {
+            dispatch_strips(strips, size);
+        }
+        else {
+            busy += work_strips(&v, row_kernel, accel_band, bands, &out, file, strip_rows, &strips_done);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        double frame_time = MPI_Wtime() - start_time;
+        if (rank == 0) {
+            printf("Frame [%d]: %f seconds\n", k, frame_time);
+        }
+        AVG += frame_time;
+    }
+    MPI_File_close(&file);
+
+    // how evenly the strips spread, a worker that renders for the whole frame is at 100%
+    double* all_busy = rank == 0 ? malloc(sizeof(double) * size) : NULL;
+    int* all_strips = rank == 0 ? malloc(sizeof(int) * size) : NULL;
+    MPI_Gather(&busy, 1, MPI_DOUBLE, all_busy, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather(&strips_done, 1, MPI_INT, all_strips, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        for (int w = 1; w < size; w++) {
+            printf("Worker %d: %d strips, rendering %.1f%% of the time\n", w, all_strips[w], 100.0 * all_busy[w] / AVG);
+        }
+        printf("Written to %s\n", output);
+        printf("The average frame time of %d frames on %d workers is: %f ms\n", N, size - 1, AVG / N * 1000);
+    }
+
+    if (strcmp(mode, "deep") == 0) {
+        free_deep_reference();
+    }
+    free(all_busy);
+    free(all_strips);
+    free(accel_band);
+    free(bands[0]);
+    free(bands[1]);
+    MPI_Finalize();
+    return 0;
+}
+#endif
+
+// usage: ./out threads [mode] [width] [height] [max_iter] [center_real] [center_imag] [zoom] [output] [trials] [format]
+// mode is simd (default), scalar, float, accel or deep, format is p5 (default, binary) or p2 (ASCII)
+int main(int argc, char** argv) {
+
+#ifdef USE_MPI
+    return mpi_main(argc, argv);
+#endif
+    int threads_given;
+    const char* mode = "simd";
+    const char* output = "mandelbrot.pgm";
+    struct view v = {WIDTH, HEIGHT, MAX_ITER, 0.0, 0.0, 4.0};
+    int N = 10; // number of trials
+    int binary = 1;
+    if (parse_args(argc, argv, &threads_given, &mode, &v, &output, &N, &binary)) {
+        return 1;
+    }
+
 
 
     omp_set_num_threads(threads_given);
-    int image[HEIGHT][WIDTH]; //I was getting a stack smashing error because when I increase thread number each cant maintain its stack without causing a bufferoverflow so i could use heap memory
+    struct pgm_out out;
+    init_pgm_out(&out, &v, binary);
+    // the image is never held whole, it goes through a band of TILE rows per thread
+    // (a whole int image[HEIGHT][WIDTH] on the stack used to smash the stack as the thread count went up)
+    int band_rows = threads_given * TILE < v.height ? threads_given * TILE : v.height;
+    unsigned char* band = malloc((long)out.bpp * band_rows * v.width);
+    int* accel_band = NULL; // Mariani-Silver looks at the counts it already has, so it renders into an int band first
     double AVG = 0;
-    int N = 10; // number of trials
-    double total_time[N];
-    struct complex c;
-    int chunk_size = 1; // since one row at a time
+    double* total_time = malloc(sizeof(double) * (N > 0 ? N : 1));
+
+    row_kernel_t reference;
+    int accel = strcmp(mode, "accel") == 0;
+    int deep = strcmp(mode, "deep") == 0;
+    long work = 0;
+    row_kernel_t row_kernel = setup_renderer(mode, &v, argc, argv, &reference, 1);
+    if (accel) {
+        accel_band = malloc(sizeof(int) * (long)band_rows * v.width);
+    }
+    printf("Image: %dx%d, max_iter %d, center (%g, %g), span %g, bands of %d rows, %s\n",
+           v.width, v.height, v.max_iter, v.center_real, v.center_imag, v.span, band_rows,
+           !binary ? "P2" : out.bpp == 1 ? "P5 8-bit" : "P5 16-bit");
+
 
-    
     for (int k=0; k<N; k++){
       clock_t start_time = clock(); // Start measuring time
-      int i, j;
       //critical section
-      #pragma omp parallel for schedule(dynamic,chunk_size) // dynamic since execution time varies at each iteration
-        for (i = 0; i < HEIGHT; i++) {
-            for (j = 0; j < WIDTH; j++) {
-                c.real = (j - WIDTH / 2.0) * 4.0 / WIDTH;
-                c.imag = (i - HEIGHT / 2.0) * 4.0 / HEIGHT;
-                image[i][j] = cal_pixel(c);
-            }
-        }
+      for (int b0 = 0; b0 < v.height; b0 += band_rows) {
+        int rows = v.height - b0 < band_rows ? v.height - b0 : band_rows;
+        render_band(&v, row_kernel, accel_band, band, &out, b0, rows);
+      }
+
 
-         
 
       clock_t end_time = clock(); // End measuring time
 
@@ -99,10 +1114,58 @@ int main(int argc, char** argv) {
       AVG += total_time[k];
     }
 
-    save_pgm("mandelbrot.pgm", image);
-    printf("The average execution time of 10 trials is: %f ms", AVG/N*1000);
-    printf("\n");
-    
+    // the image render that is kept, each band goes to the file as soon as it is done
+    // the vector kernels have to give exactly what the scalar kernel gives, small images are checked band by band
+    if (open_pgm(output, &v, &out)) {
+        printf("Could not open %s\n", output);
+        return 1;
+    }
+    // deep views can only be checked while the scalar path still resolves their pixels
+    int verify = row_kernel != reference && (long)v.width * v.height <= VERIFY_PIXELS
+                 && (!deep || v.span / v.width > 1e-13);
+    int* expected = verify ? malloc(sizeof(int) * v.width) : NULL;
+    long differ = 0;
+    long full_work = 0; // the scalar kernel iterates exactly as often as the value it returns
+    double verify_time = 0;
+    double stream_time = omp_get_wtime();
+    for (int b0 = 0; b0 < v.height; b0 += band_rows) {
+        int rows = v.height - b0 < band_rows ? v.height - b0 : band_rows;
+        work += render_band(&v, row_kernel, accel_band, band, &out, b0, rows);
+        double verify_start = omp_get_wtime();
+        for (int i = 0; verify && i < rows; i++) {
+            struct pixel_row expected_row = {(unsigned char*)expected, (int)sizeof(int), out.maxval};
+            reference(&v, b0 + i, &expected_row);
+            for (int j = 0; j < v.width; j++) {
+                int value = expected[j] < out.maxval ? expected[j] : out.maxval;
+                differ += value != load_pixel(band, (long)i*v.width + j, &out);
+                full_work += expected[j];
+            }
+        }
+        verify_time += omp_get_wtime() - verify_start;
+    }
+    close_pgm(&out);
+    stream_time = omp_get_wtime() - stream_time - verify_time;
+    printf("Rendered and written to %s in %f seconds\n", output, stream_time);
+
+    if (verify) {
+        printf("Pixels differing from the scalar path: %ld\n", differ);
+        if (accel) {
+            printf("Iterations: %ld instead of %ld (%.2fx fewer)\n", work, full_work, (double)full_work / work);
+        }
+    }
+
+    if (N > 0) {
+        printf("The average execution time of %d trials is: %f ms", N, AVG/N*1000);
+        printf("\n");
+    }
+
+    if (deep) {
+        free_deep_reference();
+    }
+    free(expected);
+    free(total_time);
+    free(accel_band);
+    free(band);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,32 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include <omp.h>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+// register tile of the blocked multiply, MR rows of A times NR columns of B stay in registers
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define MR 8
+#define NR 8
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define MR 4
+#define NR 8
+#else
+#define MR 4
+#define NR 4
+#endif
+
+// cache blocking of the blocked multiply
+#define MC 96   // MC x KC block of A is packed per thread and stays in L2
+#define KC 256  // KC x NR sliver of B stays in L1 while a micro-kernel runs
+#define NC 2048 // KC x NC panel of B is packed once and shared by all threads in L3
+
+#define TB 32 // tile side of the blocked transposes, a source and a destination tile fit in L1 together
 
 void transpose(double *A, double *B, int n) {
     int i,j;
@@ -11,6 +37,44 @@ void transpose(double *A, double *B, int n) {
     }
 }
 
+// B = A^T tile by tile, so both the reads and the strided writes stay inside a few pages
+void transpose_omp(double *A, double *B, int n) {
+    int ii, jj;
+    #pragma omp parallel for collapse(2) schedule(static)
+    for(ii=0; ii<n; ii+=TB) {
+        for(jj=0; jj<n; jj+=TB) {
+            int i, j;
+            int i_end = ii+TB < n ? ii+TB : n;
+            int j_end = jj+TB < n ? jj+TB : n;
+            for(i=ii; i<i_end; i++) {
+                for(j=jj; j<j_end; j++) {
+                    B[(long)j*n+i] = A[(long)i*n+j];
+                }
+            }
+        }
+    }
+}
+
+// A = A^T in place, iteration bi swaps tile (bi, bj) with tile (bj, bi) for every bj >= bi so no two threads touch the same tile
+void transpose_inplace_omp(double *A, int n) {
+    int bi, nb = (n+TB-1)/TB;
+    #pragma omp parallel for schedule(dynamic)
+    for(bi=0; bi<nb; bi++) {
+        int bj, i, j;
+        for(bj=bi; bj<nb; bj++) {
+            int i_end = (bi+1)*TB < n ? (bi+1)*TB : n;
+            int j_end = (bj+1)*TB < n ? (bj+1)*TB : n;
+            for(i=bi*TB; i<i_end; i++) {
+                for(j=(bi==bj ? i+1 : bj*TB); j<j_end; j++) {
+                    double t = A[(long)i*n+j];
+                    A[(long)i*n+j] = A[(long)j*n+i];
+                    A[(long)j*n+i] = t;
+                }
+            }
+        }
+    }
+}
+
 void mm(double *A, double *B, double *C, int n) 
 {   
     int i, j, k;
@@ -62,11 +126,9 @@ void mmT(double *A, double *B, double *C, int n)
     free(B2);
 }
 
-void mmT_omp(double *A, double *B, double *C, int n) 
-{   
-    double *B2;
-    B2 = (double*)malloc(sizeof(double)*n*n);
-    transpose(B,B2, n);
+// C = A * B given B2 = B^T
+void mm_bt_omp(double *A, double *B2, double *C, int n)
+{
     #pragma omp parallel
     {
         int i, j, k;
@@ -82,15 +144,572 @@ void mmT_omp(double *A, double *B, double *C, int n)
         }
 
     }
+}
+
+void mmT_omp(double *A, double *B, double *C, int n) 
+{   
+    double *B2;
+    B2 = (double*)malloc(sizeof(double)*n*n);
+    transpose_omp(B,B2, n);
+    mm_bt_omp(A, B2, C, n);
     free(B2);
 }
 
+// C[MR x NR] += Ap * Bp, where Ap is a packed MR x kc sliver of A and Bp a packed kc x NR sliver of B
+void micro_kernel(int kc, const double *Ap, const double *Bp, double *C, int ldc)
+{
+    int k, r;
+#if defined(__AVX512F__)
+    __m512d c[MR];
+    for (r = 0; r < MR; r++) c[r] = _mm512_setzero_pd();
+    for (k = 0; k < kc; k++) {
+        __m512d b = _mm512_load_pd(Bp + k*NR);
+        for (r = 0; r < MR; r++) {
+            c[r] = _mm512_fmadd_pd(_mm512_set1_pd(Ap[k*MR+r]), b, c[r]);
+        }
+    }
+    for (r = 0; r < MR; r++) {
+        _mm512_storeu_pd(C + r*ldc, _mm512_add_pd(_mm512_loadu_pd(C + r*ldc), c[r]));
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    __m256d c[MR][2];
+    for (r = 0; r < MR; r++) c[r][0] = c[r][1] = _mm256_setzero_pd();
+    for (k = 0; k < kc; k++) {
+        __m256d b0 = _mm256_load_pd(Bp + k*NR);
+        __m256d b1 = _mm256_load_pd(Bp + k*NR + 4);
+        for (r = 0; r < MR; r++) {
+            __m256d a = _mm256_broadcast_sd(Ap + k*MR + r);
+            c[r][0] = _mm256_fmadd_pd(a, b0, c[r][0]);
+            c[r][1] = _mm256_fmadd_pd(a, b1, c[r][1]);
+        }
+    }
+    for (r = 0; r < MR; r++) {
+        _mm256_storeu_pd(C + r*ldc, _mm256_add_pd(_mm256_loadu_pd(C + r*ldc), c[r][0]));
+        _mm256_storeu_pd(C + r*ldc + 4, _mm256_add_pd(_mm256_loadu_pd(C + r*ldc + 4), c[r][1]));
+    }
+#else
+    int j;
+    double c[MR][NR] = {{0}};
+    for (k = 0; k < kc; k++) {
+        for (r = 0; r < MR; r++) {
+            for (j = 0; j < NR; j++) {
+                c[r][j] += Ap[k*MR+r] * Bp[k*NR+j];
+            }
+        }
+    }
+    for (r = 0; r < MR; r++) {
+        for (j = 0; j < NR; j++) {
+            C[r*ldc+j] += c[r][j];
+        }
+    }
+#endif
+}
+
+// packs the mc x kc block of A at (i, p) into MR row slivers, zero padded to a multiple of MR rows
+void pack_A(double *A, double *Ap, int i, int p, int mc, int kc, int n)
+{
+    int i0, k, r;
+    for (i0 = 0; i0 < mc; i0 += MR) {
+        for (k = 0; k < kc; k++) {
+            for (r = 0; r < MR; r++) {
+                *Ap++ = i0 + r < mc ? A[(i+i0+r)*n + p+k] : 0;
+            }
+        }
+    }
+}
+
+// packs the NR column sliver j0 of the kc x nc panel of B at (p, j), zero padded past column nc
+void pack_B_sliver(double *B, double *Bp, int p, int j, int j0, int kc, int nc, int n)
+{
+    int k, c;
+    Bp += j0*kc;
+    for (k = 0; k < kc; k++) {
+        for (c = 0; c < NR; c++) {
+            *Bp++ = j0 + c < nc ? B[(p+k)*n + j+j0+c] : 0;
+        }
+    }
+}
+
+// bytes needed to keep every panel of B packed, the panel at (pc, jc) starts at jc*n + pc*ncr
+// where ncr is the panel width rounded up to NR, so the slivers keep the alignment of the buffer
+size_t packed_b_bytes(int n)
+{
+    size_t bytes = sizeof(double)*n*(size_t)((n+NR-1)/NR*NR);
+    return (bytes+63)/64*64;
+}
+
+void pack_B_all(double *B, double *Bpacked, int n)
+{
+    int jc, pc, j0;
+    #pragma omp parallel for collapse(2) private(j0)
+    for (jc = 0; jc < n; jc += NC) {
+        for (pc = 0; pc < n; pc += KC) {
+            int nc = n - jc < NC ? n - jc : NC;
+            int kc = n - pc < KC ? n - pc : KC;
+            int ncr = (nc+NR-1)/NR*NR;
+            for (j0 = 0; j0 < nc; j0 += NR) {
+                pack_B_sliver(B, Bpacked + (long)jc*n + (long)pc*ncr, pc, jc, j0, kc, nc, n);
+            }
+        }
+    }
+}
+
+// GotoBLAS style multiply, the threads share one packed panel of B and each packs its own blocks of A
+// with Bpacked from pack_B_all the panels are used as they are instead of being packed again
+void blocked_multiply(double *A, double *B, double *Bpacked, double *C, int n)
+{
+    double *Bp = Bpacked ? NULL : (double*)aligned_alloc(64, sizeof(double)*KC*NC);
+
+    #pragma omp parallel
+    {
+        double *Ap = (double*)aligned_alloc(64, sizeof(double)*MC*KC);
+        double edge[MR*NR];
+        long i;
+        int ic, jc, pc, i0, j0, r, c;
+
+        #pragma omp for
+        for (i = 0; i < (long)n*n; i++) {
+            C[i] = 0;
+        }
+
+        for (jc = 0; jc < n; jc += NC) {
+            int nc = n - jc < NC ? n - jc : NC;
+            for (pc = 0; pc < n; pc += KC) {
+                int kc = n - pc < KC ? n - pc : KC;
+                double *panel = Bp;
+
+                if (Bpacked) {
+                    panel = Bpacked + (long)jc*n + (long)pc*((nc+NR-1)/NR*NR);
+                }
+                else {
+                    #pragma omp for
+                    for (j0 = 0; j0 < nc; j0 += NR) {
+                        pack_B_sliver(B, Bp, pc, jc, j0, kc, nc, n);
+                    }
+                }
+
+                #pragma omp for schedule(dynamic)
+                for (ic = 0; ic < n; ic += MC) {
+                    int mc = n - ic < MC ? n - ic : MC;
+                    pack_A(A, Ap, ic, pc, mc, kc, n);
+
+                    for (j0 = 0; j0 < nc; j0 += NR) {
+                        for (i0 = 0; i0 < mc; i0 += MR) {
+                            double *Ct = &C[(long)(ic+i0)*n + jc+j0];
+                            if (i0 + MR <= mc && j0 + NR <= nc) {
+                                micro_kernel(kc, Ap + i0*kc, panel + j0*kc, Ct, n);
+                            }
+                            else {
+                                // partial tile at the matrix edge goes through a scratch tile
+                                for (r = 0; r < MR*NR; r++) edge[r] = 0;
+                                micro_kernel(kc, Ap + i0*kc, panel + j0*kc, edge, NR);
+                                for (r = 0; r < MR && i0 + r < mc; r++) {
+                                    for (c = 0; c < NR && j0 + c < nc; c++) {
+                                        Ct[(long)r*n+c] += edge[r*NR+c];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        free(Ap);
+    }
+
+    free(Bp);
+}
+
+void mm_blocked_omp(double *A, double *B, double *C, int n)
+{
+    blocked_multiply(A, B, NULL, C, n);
+}
+
+// a B that many A's get multiplied with, kept transposed for mm_bt_omp and packed for blocked_multiply
+// so the repeated multiplies skip the transpose and the packing of B
+struct fixed_b {
+    double *B;
+    double *BT;
+    double *packed;
+    int n;
+};
+
+void fixed_b_init(struct fixed_b *f, double *B, int n)
+{
+    f->B = B;
+    f->n = n;
+    f->BT = (double*)malloc(sizeof(double)*n*n);
+    f->packed = (double*)aligned_alloc(64, packed_b_bytes(n));
+    transpose_omp(B, f->BT, n);
+    pack_B_all(B, f->packed, n);
+}
+
+void fixed_b_free(struct fixed_b *f)
+{
+    free(f->BT);
+    free(f->packed);
+}
+
+void mmT_omp_fixed(double *A, struct fixed_b *f, double *C)
+{
+    mm_bt_omp(A, f->BT, C, f->n);
+}
+
+void mm_blocked_omp_fixed(double *A, struct fixed_b *f, double *C)
+{
+    blocked_multiply(A, f->B, f->packed, C, f->n);
+}
+
+// tunables of the recursive multiply, set from the command line
+int rec_cutoff = 64;     // blocks with every side <= rec_cutoff are multiplied directly
+int strassen_levels = 2; // how many top levels of mm_strassen_omp use Strassen
+
+// C += A * B for an m x k block of A and a k x p block of B, each with its own row stride
+// the largest side is halved until the blocks fit in cache, so it works for any sizes
+// halving m or p gives two independent tasks, halving k has to run one half after the other
+void rec_mm(const double *A, int lda, const double *B, int ldb, double *C, int ldc, int m, int k, int p)
+{
+    int h;
+    if (m <= rec_cutoff && k <= rec_cutoff && p <= rec_cutoff) {
+        int i, j, kk;
+        for (i = 0; i < m; i++) {
+            for (kk = 0; kk < k; kk++) {
+                double a = A[(long)i*lda+kk];
+                for (j = 0; j < p; j++) {
+                    C[(long)i*ldc+j] += a*B[(long)kk*ldb+j];
+                }
+            }
+        }
+        return;
+    }
+
+    if (m >= k && m >= p) {
+        h = m/2;
+        #pragma omp task
+        rec_mm(A, lda, B, ldb, C, ldc, h, k, p);
+        rec_mm(A + (long)h*lda, lda, B, ldb, C + (long)h*ldc, ldc, m-h, k, p);
+        #pragma omp taskwait
+    }
+    else if (p >= k) {
+        h = p/2;
+        #pragma omp task
+        rec_mm(A, lda, B, ldb, C, ldc, m, k, h);
+        rec_mm(A, lda, B + h, ldb, C + h, ldc, m, k, p-h);
+        #pragma omp taskwait
+    }
+    else {
+        h = k/2;
+        rec_mm(A, lda, B, ldb, C, ldc, m, h, p);
+        rec_mm(A + h, lda, B + (long)h*ldb, ldb, C, ldc, m, k-h, p);
+    }
+}
+
+// Z = X + sign*Y for h x h blocks, Z is contiguous
+void block_add(const double *X, int ldx, const double *Y, int ldy, double sign, double *Z, int h)
+{
+    int i, j;
+    for (i = 0; i < h; i++) {
+        for (j = 0; j < h; j++) {
+            Z[(long)i*h+j] = X[(long)i*ldx+j] + sign*Y[(long)i*ldy+j];
+        }
+    }
+}
+
+// C = A * B for n x n blocks, Strassen on the top strassen_levels levels and rec_mm below
+// an odd n is peeled, Strassen runs on the even leading part and the last row and column go through rec_mm
+void strassen(const double *A, int lda, const double *B, int ldb, double *C, int ldc, int n, int level)
+{
+    int i, j, x;
+    if (level >= strassen_levels || n <= 2*rec_cutoff) {
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < n; j++) C[(long)i*ldc+j] = 0;
+        }
+        rec_mm(A, lda, B, ldb, C, ldc, n, n, n);
+        return;
+    }
+
+    int e = n & ~1, h = e/2;
+    const double *A11 = A, *A12 = A + h, *A21 = A + (long)h*lda, *A22 = A21 + h;
+    const double *B11 = B, *B12 = B + h, *B21 = B + (long)h*ldb, *B22 = B21 + h;
+    double *M[7];
+    for (x = 0; x < 7; x++) {
+        M[x] = (double*)malloc(sizeof(double)*h*h);
+    }
+
+    for (x = 0; x < 7; x++) {
+        #pragma omp task firstprivate(x)
+        {
+            double *S = (double*)malloc(sizeof(double)*h*h);
+            double *T = (double*)malloc(sizeof(double)*h*h);
+            switch (x) {
+            case 0: // M1 = (A11 + A22)(B11 + B22)
+                block_add(A11, lda, A22, lda, 1, S, h);
+                block_add(B11, ldb, B22, ldb, 1, T, h);
+                strassen(S, h, T, h, M[x], h, h, level+1);
+                break;
+            case 1: // M2 = (A21 + A22) B11
+                block_add(A21, lda, A22, lda, 1, S, h);
+                strassen(S, h, B11, ldb, M[x], h, h, level+1);
+                break;
+            case 2: // M3 = A11 (B12 - B22)
+                block_add(B12, ldb, B22, ldb, -1, T, h);
+                strassen(A11, lda, T, h, M[x], h, h, level+1);
+                break;
+            case 3: // M4 = A22 (B21 - B11)
+                block_add(B21, ldb, B11, ldb, -1, T, h);
+                strassen(A22, lda, T, h, M[x], h, h, level+1);
+                break;
+            case 4: // M5 = (A11 + A12) B22
+                block_add(A11, lda, A12, lda, 1, S, h);
+                strassen(S, h, B22, ldb, M[x], h, h, level+1);
+                break;
+            case 5: // M6 = (A21 - A11)(B11 + B12)
+                block_add(A21, lda, A11, lda, -1, S, h);
+                block_add(B11, ldb, B12, ldb, 1, T, h);
+                strassen(S, h, T, h, M[x], h, h, level+1);
+                break;
+            case 6: // M7 = (A12 - A22)(B21 + B22)
+                block_add(A12, lda, A22, lda, -1, S, h);
+                block_add(B21, ldb, B22, ldb, 1, T, h);
+                strassen(S, h, T, h, M[x], h, h, level+1);
+                break;
+            }
+            free(S);
+            free(T);
+        }
+    }
+    #pragma omp taskwait
+
+    #pragma omp taskloop
+    for (i = 0; i < h; i++) {
+        int jj;
+        double *C11 = C + (long)i*ldc, *C12 = C11 + h, *C21 = C + (long)(i+h)*ldc, *C22 = C21 + h;
+        for (jj = 0; jj < h; jj++) {
+            long t = (long)i*h+jj;
+            C11[jj] = M[0][t] + M[3][t] - M[4][t] + M[6][t];
+            C12[jj] = M[2][t] + M[4][t];
+            C21[jj] = M[1][t] + M[3][t];
+            C22[jj] = M[0][t] - M[1][t] + M[2][t] + M[5][t];
+        }
+    }
+
+    for (x = 0; x < 7; x++) {
+        free(M[x]);
+    }
+
+    if (e < n) {
+        // leading block picks up the last column of A times the last row of B
+        rec_mm(A + e, lda, B + (long)e*ldb, ldb, C, ldc, e, 1, e);
+        // last column and last row of C
+        for (i = 0; i < n; i++) {
+            C[(long)i*ldc+e] = 0;
+            C[(long)e*ldc+i] = 0;
+        }
+        rec_mm(A, lda, B + e, ldb, C + e, ldc, e, n, 1);
+        rec_mm(A + (long)e*lda, lda, B, ldb, C + (long)e*ldc, ldc, 1, n, n);
+    }
+}
+
+void mm_rec_omp(double *A, double *B, double *C, int n)
+{
+    long i;
+    #pragma omp parallel for
+    for (i = 0; i < (long)n*n; i++) {
+        C[i] = 0;
+    }
+    #pragma omp parallel
+    #pragma omp single
+    rec_mm(A, n, B, n, C, n, n, n, n);
+}
+
+void mm_strassen_omp(double *A, double *B, double *C, int n)
+{
+    #pragma omp parallel
+    #pragma omp single
+    strassen(A, n, B, n, C, n, n, 0);
+}
+
+double max_abs_diff(double *X, double *Y, int n)
+{
+    double diff = 0;
+    long i;
+    for (i = 0; i < (long)n*n; i++) {
+        if (fabs(X[i] - Y[i]) > diff) diff = fabs(X[i] - Y[i]);
+    }
+    return diff;
+}
+
+#ifdef USE_MPI
+// distributed multiply, built with mpicc -fopenmp -DUSE_MPI
+// the ranks form a q x q grid and rank (r, c) owns the m x m blocks A_rc, B_rc and C_rc with m = n/q
+// the matrices are never held whole anywhere, every rank generates its own blocks
+
+// deterministic entry (i, j) of the global A (which = 0) or B (which = 1)
+double summa_entry(long i, long j, int which)
+{
+    unsigned long long x = (unsigned long long)i * 2654435761ULL ^ (unsigned long long)j * 40503ULL ^ (unsigned long long)which * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (double)(x >> 11) / (double)(1ULL << 53);
+}
+
+// SUMMA, step k broadcasts A_rk along grid row r and B_kc along grid column c, then C_rc += A_rk * B_kc
+// the broadcasts of step k+1 are posted before the local product of step k so they overlap with it
+// returns the max error over a few sampled entries of C checked against a direct dot product
+double summa(int n, int q, MPI_Comm row_comm, MPI_Comm col_comm, void (*kernel)(double*, double*, double*, int), double *dtime)
+{
+    int row, col, k, cur, x;
+    long i, j, m2;
+    int m = n / q;
+    MPI_Comm_rank(col_comm, &row); // position inside my grid column = my grid row
+    MPI_Comm_rank(row_comm, &col);
+    m2 = (long)m*m;
+
+    double *A = (double*)malloc(sizeof(double)*m2);
+    double *B = (double*)malloc(sizeof(double)*m2);
+    double *C = (double*)calloc(m2, sizeof(double));
+    double *T = (double*)malloc(sizeof(double)*m2);
+    double *Abuf[2], *Bbuf[2];
+    MPI_Request req[2][2];
+    for (x = 0; x < 2; x++) {
+        Abuf[x] = (double*)malloc(sizeof(double)*m2);
+        Bbuf[x] = (double*)malloc(sizeof(double)*m2);
+    }
+    for (i = 0; i < m; i++) {
+        for (j = 0; j < m; j++) {
+            A[i*m+j] = summa_entry((long)row*m+i, (long)col*m+j, 0);
+            B[i*m+j] = summa_entry((long)row*m+i, (long)col*m+j, 1);
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    *dtime = MPI_Wtime();
+
+    for (k = 0; k <= q; k++) {
+        cur = k & 1;
+        // post the broadcasts of step k, the buffer was last used by step k-2
+        if (k < q) {
+            if (col == k) memcpy(Abuf[cur], A, sizeof(double)*m2);
+            if (row == k) memcpy(Bbuf[cur], B, sizeof(double)*m2);
+            MPI_Ibcast(Abuf[cur], m2, MPI_DOUBLE, k, row_comm, &req[cur][0]);
+            MPI_Ibcast(Bbuf[cur], m2, MPI_DOUBLE, k, col_comm, &req[cur][1]);
+        }
+        // multiply step k-1 while step k is in flight
+        if (k > 0) {
+            int prev = cur ^ 1;
+            MPI_Waitall(2, req[prev], MPI_STATUSES_IGNORE);
+            kernel(Abuf[prev], Bbuf[prev], T, m);
+            #pragma omp parallel for
+            for (i = 0; i < m2; i++) {
+                C[i] += T[i];
+            }
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    *dtime = MPI_Wtime() - *dtime;
+
+    // check a few entries of the local block against the full dot product
+    double err = 0, global_err;
+    for (x = 0; x < 4 && m > 0; x++) {
+        long li = (x * 7919L) % m, lj = (x * 104729L + 1) % m;
+        double dot = 0;
+        for (k = 0; k < n; k++) {
+            dot += summa_entry((long)row*m+li, k, 0) * summa_entry(k, (long)col*m+lj, 1);
+        }
+        if (fabs(dot - C[li*m+lj]) > err) err = fabs(dot - C[li*m+lj]);
+    }
+    MPI_Allreduce(&err, &global_err, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    for (x = 0; x < 2; x++) {
+        free(Abuf[x]);
+        free(Bbuf[x]);
+    }
+    free(A);
+    free(B);
+    free(C);
+    free(T);
+    return global_err;
+}
+
+// usage: mpirun -np q*q ./out threads [n] [weak_block] [mm_omp|mmT_omp|mm_blocked_omp]
+// strong scaling multiplies n x n matrices, weak scaling keeps weak_block x weak_block per rank
+int summa_main(int argc, char** argv)
+{
+    int rank, size, q, n, weak_block, dims[2], periods[2] = {0, 0}, coords[2];
+    double dtime, err, flops;
+    const char *kernel_name = "mm_omp";
+    void (*kernel)(double*, double*, double*, int) = mm_omp;
+    MPI_Comm grid, row_comm, col_comm;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc < 2) {
+        MPI_Finalize();
+        return 1;
+    }
+    omp_set_num_threads(atoi(argv[1]));
+    n = argc > 2 ? atoi(argv[2]) : 2048;
+    weak_block = argc > 3 ? atoi(argv[3]) : 1024;
+    if (argc > 4) {
+        kernel_name = argv[4];
+        if (strcmp(kernel_name, "mmT_omp") == 0) kernel = mmT_omp;
+        else if (strcmp(kernel_name, "mm_blocked_omp") == 0) kernel = mm_blocked_omp;
+        else kernel_name = "mm_omp";
+    }
+
+    // every block is square so the local products can use the square kernels as they are
+    for (q = 1; (q+1)*(q+1) <= size; q++);
+    if (q*q != size || n % q != 0) {
+        if (rank == 0) {
+            printf("SUMMA needs a square number of processes dividing n, we have %d processes and n = %d\n", size, n);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    dims[0] = dims[1] = q;
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &grid);
+    MPI_Cart_coords(grid, rank, 2, coords);
+    MPI_Comm_split(grid, coords[0], coords[1], &row_comm);
+    MPI_Comm_split(grid, coords[1], coords[0], &col_comm);
+
+    err = summa(n, q, row_comm, col_comm, kernel, &dtime);
+    flops = 2.0*n*n*n;
+    if (rank == 0) {
+        printf("summa strong (%s): n=%d grid=%dx%d time %f (%f GFLOP/s, %f GFLOP/s per rank), max error %e\n",
+               kernel_name, n, q, q, dtime, flops/dtime*1e-9, flops/dtime*1e-9/size, err);
+    }
+
+    n = weak_block*q;
+    err = summa(n, q, row_comm, col_comm, kernel, &dtime);
+    flops = 2.0*n*n*n;
+    if (rank == 0) {
+        printf("summa weak (%s): n=%d block=%d grid=%dx%d time %f (%f GFLOP/s, %f GFLOP/s per rank), max error %e\n",
+               kernel_name, n, weak_block, q, q, dtime, flops/dtime*1e-9, flops/dtime*1e-9/size, err);
+    }
+
+    MPI_Comm_free(&row_comm);
+    MPI_Comm_free(&col_comm);
+    MPI_Comm_free(&grid);
+    MPI_Finalize();
+    return 0;
+}
+#endif
+
 int main(int argc, char** argv) {
+#ifdef USE_MPI
+    return summa_main(argc, argv);
+#endif
     int i, n;
-    double *A, *B, *C, dtime;
+    double *A, *B, *C, *C_ref, dtime, flops;
     int threads_given;
 
-    if(argc!=2){
+    if(argc<2 || argc>5){
         return 1;
     }
     threads_given = atoi(argv[1]);
@@ -98,30 +717,106 @@ int main(int argc, char** argv) {
     omp_set_num_threads(threads_given); 
 
     n=2048;
+    if(argc>=3){
+        n = atoi(argv[2]);
+    }
+    if(argc>=4){
+        rec_cutoff = atoi(argv[3]);
+        if (rec_cutoff < 1) rec_cutoff = 1; // below 1 the recursion would never reach its base case
+    }
+    if(argc>=5){
+        strassen_levels = atoi(argv[4]);
+    }
+    flops = 2.0*n*n*n;
     A = (double*)malloc(sizeof(double)*n*n);
     B = (double*)malloc(sizeof(double)*n*n);
     C = (double*)malloc(sizeof(double)*n*n);
-    for(i=0; i<n*n; i++) { A[i] = rand()/RAND_MAX; B[i] = rand()/RAND_MAX;}
+    C_ref = (double*)malloc(sizeof(double)*n*n);
+    for(i=0; i<n*n; i++) { A[i] = (double)rand()/RAND_MAX; B[i] = (double)rand()/RAND_MAX;}
 
     dtime = omp_get_wtime();
-    mm(A,B,C, n);
+    mm(A,B,C_ref, n);
     dtime = omp_get_wtime() - dtime;
-    printf("mm: %f\n", dtime);
+    printf("mm: %f (%f GFLOP/s)\n", dtime, flops/dtime*1e-9);
 
     dtime = omp_get_wtime();
     mm_omp(A,B,C, n);
     dtime = omp_get_wtime() - dtime;
-    printf("mm_omp: %f\n", dtime);
+    printf("mm_omp: %f (%f GFLOP/s)\n", dtime, flops/dtime*1e-9);
 
     dtime = omp_get_wtime();
     mmT(A,B,C, n);
     dtime = omp_get_wtime() - dtime;
-    printf("mmT: %f\n", dtime);
+    printf("mmT: %f (%f GFLOP/s)\n", dtime, flops/dtime*1e-9);
 
     dtime = omp_get_wtime();
     mmT_omp(A,B,C, n);
     dtime = omp_get_wtime() - dtime;
-    printf("mmT_omp: %f\n", dtime);
+    printf("mmT_omp: %f (%f GFLOP/s)\n", dtime, flops/dtime*1e-9);
+
+    dtime = omp_get_wtime();
+    mm_blocked_omp(A,B,C, n);
+    dtime = omp_get_wtime() - dtime;
+    printf("mm_blocked_omp: %f (%f GFLOP/s), max error %e\n", dtime, flops/dtime*1e-9, max_abs_diff(C, C_ref, n));
+
+    // transposes on their own
+    double *BT = (double*)malloc(sizeof(double)*n*n);
+    dtime = omp_get_wtime();
+    transpose(B,BT, n);
+    dtime = omp_get_wtime() - dtime;
+    printf("transpose: %f\n", dtime);
+
+    dtime = omp_get_wtime();
+    transpose_omp(B,C, n);
+    dtime = omp_get_wtime() - dtime;
+    printf("transpose_omp: %f, max error %e\n", dtime, max_abs_diff(C, BT, n));
+
+    for(i=0; i<n*n; i++) C[i] = B[i];
+    dtime = omp_get_wtime();
+    transpose_inplace_omp(C, n);
+    dtime = omp_get_wtime() - dtime;
+    printf("transpose_inplace_omp: %f, max error %e\n", dtime, max_abs_diff(C, BT, n));
+    free(BT);
+
+    // one B for several A's, the transpose and packing of B happen once in fixed_b_init
+    struct fixed_b fixed;
+    int reps = 4;
+    dtime = omp_get_wtime();
+    fixed_b_init(&fixed, B, n);
+    dtime = omp_get_wtime() - dtime;
+    printf("fixed_b_init: %f\n", dtime);
+
+    dtime = omp_get_wtime();
+    for(i=0; i<reps; i++) mmT_omp_fixed(A, &fixed, C);
+    dtime = (omp_get_wtime() - dtime)/reps;
+    printf("mmT_omp_fixed: %f (%f GFLOP/s), max error %e\n", dtime, flops/dtime*1e-9, max_abs_diff(C, C_ref, n));
+
+    dtime = omp_get_wtime();
+    for(i=0; i<reps; i++) mm_blocked_omp_fixed(A, &fixed, C);
+    dtime = (omp_get_wtime() - dtime)/reps;
+    printf("mm_blocked_omp_fixed: %f (%f GFLOP/s), max error %e\n", dtime, flops/dtime*1e-9, max_abs_diff(C, C_ref, n));
+    fixed_b_free(&fixed);
+
+    // Strassen adds and subtracts whole blocks, so it only matches mm up to rounding
+    double tolerance = 1e-10*n;
+    double err;
+
+    dtime = omp_get_wtime();
+    mm_rec_omp(A,B,C, n);
+    dtime = omp_get_wtime() - dtime;
+    err = max_abs_diff(C, C_ref, n);
+    printf("mm_rec_omp: %f (%f GFLOP/s), max error %e %s\n", dtime, flops/dtime*1e-9, err, err <= tolerance ? "OK" : "FAILED");
+
+    dtime = omp_get_wtime();
+    mm_strassen_omp(A,B,C, n);
+    dtime = omp_get_wtime() - dtime;
+    err = max_abs_diff(C, C_ref, n);
+    printf("mm_strassen_omp: %f (%f GFLOP/s), max error %e %s\n", dtime, flops/dtime*1e-9, err, err <= tolerance ? "OK" : "FAILED");
+
+    free(A);
+    free(B);
+    free(C);
+    free(C_ref);
 
     return 0;
 
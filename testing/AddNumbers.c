@@ -1,72 +1,217 @@
 #include <mpi.h>
+#include <omp.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 
-#define N 100000  // Define the size of the large array
+#define N 100000  // Default size of the large array
+#define BLOCK 2048 // floats summarised at a time, small enough to still be in L1 for the second loop over them
+#define CHUNK (1 << 20) // floats read or generated at a time, two chunks are all the memory a rank needs
+
+// Everything one pass over the numbers gives: count, sum, mean and sum of squared deviations (for the variance), min, max
+struct summary {
+    double n;
+    double sum;
+    double mean;
+    double m2;
+    double min;
+    double max;
+};
+
+void empty_summary(struct summary *s) {
+    s->n = s->sum = s->mean = s->m2 = 0;
+    s->min = INFINITY;
+    s->max = -INFINITY;
+}
+
+// Chan et al.'s update combines the means and squared deviations of two parts exactly, whatever their sizes
+void merge_summary(struct summary *into, const struct summary *from) {
+    double n = into->n + from->n;
+    if (from->n == 0) return;
+    double delta = from->mean - into->mean;
+    into->mean += delta * from->n / n;
+    into->m2 += from->m2 + delta * delta * into->n * from->n / n;
+    into->n = n;
+    into->sum += from->sum;
+    into->min = from->min < into->min ? from->min : into->min;
+    into->max = from->max > into->max ? from->max : into->max;
+}
+
+void merge_summary_op(void *in, void *inout, int *len, MPI_Datatype *type) {
+    (void)type;
+    for (int i = 0; i < *len; i++) {
+        merge_summary((struct summary *)inout + i, (const struct summary *)in + i);
+    }
+}
+
+// One block: sum, min and max in one vectorised loop, then the squared deviations from the block's mean,
+// so the variance never comes from the difference of two large sums
+void summarize_block(const float *x, int n, struct summary *s) {
+    double sum = 0, m2 = 0;
+    float lo = INFINITY, hi = -INFINITY;
+    #pragma omp simd reduction(+:sum) reduction(min:lo) reduction(max:hi)
+    for (int i = 0; i < n; i++) {
+        sum += x[i];
+        lo = x[i] < lo ? x[i] : lo;
+        hi = x[i] > hi ? x[i] : hi;
+    }
+    double mean = sum / n;
+    #pragma omp simd reduction(+:m2)
+    for (int i = 0; i < n; i++) {
+        double d = x[i] - mean;
+        m2 += d * d;
+    }
+    s->n = n;
+    s->sum = sum;
+    s->mean = mean;
+    s->m2 = m2;
+    s->min = lo;
+    s->max = hi;
+}
+
+// Summary of x[0..n): every thread merges the summaries of its blocks, then the threads' summaries are merged
+// in thread order so the result does not depend on timing
+void summarize(const float *x, long n, struct summary *s) {
+    long blocks = (n + BLOCK - 1) / BLOCK;
+    int threads = omp_get_max_threads();
+    struct summary *partial = (struct summary *)malloc(threads * sizeof(struct summary));
+    #pragma omp parallel
+    {
+        struct summary mine, block;
+        empty_summary(&mine);
+        #pragma omp for schedule(static)
+        for (long b = 0; b < blocks; b++) {
+            long first = b * BLOCK;
+            summarize_block(x + first, n - first < BLOCK ? (int)(n - first) : BLOCK, &block);
+            merge_summary(&mine, &block);
+        }
+        partial[omp_get_thread_num()] = mine;
+    }
+    empty_summary(s);
+    for (int t = 0; t < threads; t++) {
+        merge_summary(s, &partial[t]);
+    }
+    free(partial);
+}
 
+// splitmix64; started at seed + i * its increment it gives the ith number of the sequence directly
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
 
+// Numbers first..first+n of the input, number i only depends on seed and i, so every rank makes its own part
+void generate_numbers(float *x, long first, long n, uint64_t seed) {
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < n; i++) {
+        uint64_t state = seed + (uint64_t)(first + i) * 0x9E3779B97F4A7C15ULL;
+        x[i] = (float)(splitmix64(&state) >> 40) * 0x1p-24f * 100.0f;  // Random float values between 0 and 100
+    }
+}
+
+// usage: mpirun -np P ./out [n]         generates n floats (default N)
+//        mpirun -np P ./out file input  reads a file of native floats
+// either way every rank makes or reads its own part of the numbers, split as evenly as possible, a chunk at a time
 int main(int argc, char** argv) {
     int rank, size;
-    float *array = NULL;
-    float partial_sum = 0.0, total_sum = 0.0;
-    float *local_array = NULL;
 
     // Initialize MPI environment
     MPI_Init(&argc, &argv);
-    
+
     // Get the rank (ID) of the current process
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    
+
     // Get the total number of processes
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    // Allocate memory for the large array in rank 0 only
-    if (rank == 0) {
-        array = (float*) malloc(N * sizeof(float));
-        
-        // Seed the random number generator and fill the array with random values
-        srand(time(NULL));  
-        for (int i = 0; i < N; i++) {
-            array[i] = ((float)rand() / (float)(RAND_MAX)) * 100.0;  // Random float values between 0 and 100
+    int from_file = argc > 2 && strcmp(argv[1], "file") == 0;
+    long n = argc > 1 && !from_file ? atol(argv[1]) : N;
+    MPI_File file;
+    if (from_file) {
+        if (MPI_File_open(MPI_COMM_WORLD, argv[2], MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+            if (rank == 0) printf("Could not open %s\n", argv[2]);
+            MPI_Finalize();
+            return 1;
         }
+        MPI_Offset bytes;
+        MPI_File_get_size(file, &bytes);
+        n = bytes / sizeof(float);
     }
-
-    // Determine the size of each subarray
-    int local_size = N / size;
-
-    // Allocate memory for the local subarray
-    local_array = (float*) malloc(local_size * sizeof(float));
-
-    // Scatter the large array into subarrays
-    // array is the send buffer which is sent from the root where the root is 0 (Master node)
-    // local array is the recieve buffer
-    MPI_Scatter(array, local_size, MPI_FLOAT, local_array, local_size, MPI_FLOAT, 0, MPI_COMM_WORLD);
-
-    // Now each process has its part
-
-    // Each process calculates the sum of its local array
-    for (int i = 0; i < local_size; i++) {
-        partial_sum += local_array[i];
+    // The seed is root's, so the numbers do not depend on how many ranks make them
+    uint64_t seed = (uint64_t)time(NULL);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    // Determine this rank's part, the first n % size ranks get one more so nothing is dropped
+    long local_size = n / size + (rank < n % size);
+    long first = rank * (n / size) + (rank < n % size ? rank : n % size);
+    float *chunks[2] = {(float*) malloc(CHUNK * sizeof(float)), (float*) malloc(CHUNK * sizeof(float))};
+
+    // Each process summarises its part in one pass over it, a chunk at a time; from a file the next chunk
+    // is read into the other buffer while one is summarised
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    struct summary partial, total, chunk;
+    empty_summary(&partial);
+    long count = (local_size + CHUNK - 1) / CHUNK;
+    MPI_Request pending = MPI_REQUEST_NULL;
+    if (from_file && count > 0) {
+        MPI_File_iread_at(file, first * sizeof(float), chunks[0], local_size < CHUNK ? (int)local_size : CHUNK, MPI_FLOAT, &pending);
+    }
+    for (long c = 0; c < count; c++) {
+        long at = c * CHUNK;
+        int len = local_size - at < CHUNK ? (int)(local_size - at) : CHUNK;
+        float *x = chunks[c % 2];
+        if (from_file) {
+            MPI_Wait(&pending, MPI_STATUS_IGNORE);
+            if (c + 1 < count) {
+                long next = at + CHUNK;
+                MPI_File_iread_at(file, (first + next) * sizeof(float), chunks[(c + 1) % 2],
+                                  local_size - next < CHUNK ? (int)(local_size - next) : CHUNK, MPI_FLOAT, &pending);
+            }
+        }
+        else {
+            generate_numbers(x, first + at, len, seed);
+        }
+        summarize(x, len, &chunk);
+        merge_summary(&partial, &chunk);
+    }
+    if (from_file) {
+        MPI_File_close(&file);
     }
 
     // Each process prints its rank and its partial sum
-    printf("Process %d, Partial Sum: %f\n", rank, partial_sum);
+    printf("Process %d, Partial Sum: %f\n", rank, partial.sum);
 
-    // Reduce all partial sums into the total sum at rank 0
-    // This is a reduce add since we are using MPI_SUM as operation
-    MPI_Reduce(&partial_sum, &total_sum, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
+    // Reduce all partial summaries into the total at rank 0, with one reduction for all statistics
+    MPI_Datatype summary_type;
+    MPI_Op merge_op;
+    MPI_Type_contiguous(6, MPI_DOUBLE, &summary_type);
+    MPI_Type_commit(&summary_type);
+    MPI_Op_create(merge_summary_op, 1, &merge_op);
+    MPI_Reduce(&partial, &total, 1, summary_type, merge_op, 0, MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
 
-    // Now the total sum is calculated
+    // Now the total is calculated
 
-    // Rank 0 prints the total sum
+    // Rank 0 prints the statistics
     if (rank == 0) {
-        printf("Total Sum: %f\n", total_sum);
-        free(array);  // Free the large array memory in rank 0
+        printf("Total Sum: %f\n", total.sum);
+        printf("Min: %f, Max: %f\n", total.min, total.max);
+        printf("Mean: %f, Variance: %f\n", total.mean, total.n > 1 ? total.m2 / (total.n - 1) : 0.0);
+        printf("%ld numbers in %f seconds (%.2f GB/s) with %d threads per process\n", n, elapsed,
+               n * sizeof(float) / elapsed / 1e9, omp_get_max_threads());
     }
 
-    // Free the local array memory in all ranks
-    free(local_array);
+    // Free the chunk buffers in all ranks
+    MPI_Op_free(&merge_op);
+    MPI_Type_free(&summary_type);
+    free(chunks[0]);
+    free(chunks[1]);
 
     // Finalize the MPI environment
     MPI_Finalize();
@@ -1,11 +1,300 @@
 #include <mpi.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <unistd.h>
+
+#define OVERSAMPLE 32 // samples per rank per bucket, more samples even out the buckets more
+#define RADIX_BITS 11 // radix sort digit, 3 passes over 32 bit keys with a 2048 entry count table per thread
+#define RADIX (1 << RADIX_BITS)
+#define MERGE_GROUP 8 // runs from this many neighbouring ranks are merged as soon as all of them have arrived
+#define READ_CHUNK (1 << 20) // keys per read of an input file, the next chunk is read while one is sorted
+
+enum distribution { UNIFORM, SKEWED, WIDE, DUP };
 
 // Function to compare two integers for qsort
+// (a subtraction overflows once the keys span more than half the int range)
 int compare(const void *a, const void *b) {
-    return (*(int *)a - *(int *)b);
+    int x = *(int *)a, y = *(int *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// The digit of a key at shift, with the sign bit flipped so that unsigned digit order is int order
+static inline int radix_digit(int key, int shift) {
+    return (((uint32_t)key ^ 0x80000000u) >> shift) & (RADIX - 1);
+}
+
+// Parallel LSD radix sort of n ints, tmp must hold n ints as well
+// every thread counts the digits of its own slice, a prefix sum over (digit, thread) tells every thread where
+// its keys of each digit go, and the threads scatter their slices in order, so every pass is stable
+// a pass where all keys have the same digit is skipped (keys below 2^21 need only two passes)
+// returns the buffer that ends up holding the sorted keys, data or tmp
+int *radix_sort(int *data, int *tmp, int n) {
+    long *counts = (long *)malloc((long)omp_get_max_threads() * RADIX * sizeof(long));
+    for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+        int skip = 0;
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num(), threads = omp_get_num_threads();
+            long *mine = counts + (long)t * RADIX;
+            long lo = (long)n * t / threads, hi = (long)n * (t + 1) / threads;
+            memset(mine, 0, RADIX * sizeof(long));
+            for (long i = lo; i < hi; i++) {
+                mine[radix_digit(data[i], shift)]++;
+            }
+            #pragma omp barrier
+            #pragma omp single
+            {
+                long offset = 0;
+                for (int d = 0; d < RADIX; d++) {
+                    long start = offset;
+                    for (int u = 0; u < threads; u++) {
+                        long c = counts[(long)u * RADIX + d];
+                        counts[(long)u * RADIX + d] = offset;
+                        offset += c;
+                    }
+                    skip |= offset - start == n;
+                }
+            }
+            if (!skip) {
+                for (long i = lo; i < hi; i++) {
+                    tmp[mine[radix_digit(data[i], shift)]++] = data[i];
+                }
+            }
+        }
+        if (!skip) {
+            int *swap = data;
+            data = tmp;
+            tmp = swap;
+        }
+    }
+    free(counts);
+    return data;
+}
+
+// A sorted run, keys[0..n)
+struct run {
+    const int *keys;
+    long n;
+};
+
+static long lower_bound(const int *keys, long n, int key) {
+    long lo = 0, hi = n;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (keys[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Number of keys <= key
+static long upper_bound(const int *keys, long n, int64_t key) {
+    return key >= INT32_MAX ? n : lower_bound(keys, n, (int)key + 1);
+}
+
+// Co-ranks of output position r in the merge of k runs: splits[i] keys of run i come before position r
+// the smallest key x with at least r keys <= x is found by bisection over the int range, everything below x
+// goes first and the keys equal to x are taken from the lower runs first, as the merge itself does
+void co_rank(const struct run *runs, int k, long r, long *splits) {
+    int64_t lo = INT32_MIN, hi = INT32_MAX;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        long count = 0;
+        for (int i = 0; i < k; i++) {
+            count += upper_bound(runs[i].keys, runs[i].n, mid);
+        }
+        if (count >= r) hi = mid;
+        else lo = mid + 1;
+    }
+    long remaining = r;
+    for (int i = 0; i < k; i++) {
+        splits[i] = lower_bound(runs[i].keys, runs[i].n, (int)lo);
+        remaining -= splits[i];
+    }
+    for (int i = 0; i < k && remaining > 0; i++) {
+        long equal = upper_bound(runs[i].keys, runs[i].n, lo) - splits[i];
+        long take = equal < remaining ? equal : remaining;
+        splits[i] += take;
+        remaining -= take;
+    }
+}
+
+// k-way merge of runs into out with a loser tree: every inner node keeps the loser of the match below it,
+// so after the winner is output only the matches on its way up to the root are played again
+// an exhausted run plays with a key above every int, equal keys go to the lower run
+void loser_tree_merge(const struct run *runs, int k, int *out) {
+    int leaves = 1;
+    while (leaves < k) leaves *= 2;
+    int *tree = (int *)malloc(leaves * sizeof(int)); // tree[1..leaves) hold the losers
+    long *pos = (long *)calloc(leaves, sizeof(long));
+    long total = 0;
+    for (int i = 0; i < k; i++) total += runs[i].n;
+    #define LEAF_KEY(i) ((i) < k && pos[i] < runs[i].n ? (int64_t)runs[i].keys[pos[i]] : INT64_MAX)
+    #define BEATS(a, b) (LEAF_KEY(a) < LEAF_KEY(b) || (LEAF_KEY(a) == LEAF_KEY(b) && (a) < (b)))
+    // first round, bottom up: play[leaves + i] is leaf i and the winner of node n goes to play[n]
+    int *play = (int *)malloc(2 * leaves * sizeof(int));
+    for (int i = 0; i < leaves; i++) play[leaves + i] = i;
+    for (int node = leaves - 1; node >= 1; node--) {
+        int a = play[2 * node], b = play[2 * node + 1];
+        play[node] = BEATS(a, b) ? a : b;
+        tree[node] = BEATS(a, b) ? b : a;
+    }
+    int winner = leaves > 1 ? play[1] : 0;
+    free(play);
+    for (long o = 0; o < total; o++) {
+        out[o] = runs[winner].keys[pos[winner]++];
+        for (int node = (winner + leaves) / 2; node >= 1; node /= 2) {
+            if (BEATS(tree[node], winner)) {
+                int loser = winner;
+                winner = tree[node];
+                tree[node] = loser;
+            }
+        }
+    }
+    #undef BEATS
+    #undef LEAF_KEY
+    free(tree);
+    free(pos);
+}
+
+// k-way merge with the output cut into one equal piece per thread, the co-ranks of the cuts tell every thread
+// which part of every run it merges
+void parallel_merge(const struct run *runs, int k, int *out) {
+    long total = 0;
+    for (int i = 0; i < k; i++) total += runs[i].n;
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num(), threads = omp_get_num_threads();
+        long r0 = total * t / threads, r1 = total * (t + 1) / threads;
+        long *lo = (long *)malloc(2 * k * sizeof(long)), *hi = lo + k;
+        struct run *parts = (struct run *)malloc(k * sizeof(struct run));
+        co_rank(runs, k, r0, lo);
+        co_rank(runs, k, r1, hi);
+        for (int i = 0; i < k; i++) {
+            parts[i].keys = runs[i].keys + lo[i];
+            parts[i].n = hi[i] - lo[i];
+        }
+        loser_tree_merge(parts, k, out + r0);
+        free(parts);
+        free(lo);
+    }
+}
+
+// splitmix64; started at seed + i * its increment it gives the ith number of the sequence directly
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+enum distribution parse_distribution(const char *name) {
+    if (strcmp(name, "skewed") == 0) return SKEWED;
+    if (strcmp(name, "wide") == 0) return WIDE;
+    if (strcmp(name, "dup") == 0) return DUP;
+    return UNIFORM;
+}
+
+// Keys first..first+n of the input, key i only depends on seed and i, so every rank makes its own part
+// and the keys are the same whatever the number of ranks and threads
+void generate_keys(int *keys, long first, long n, uint64_t seed, enum distribution distribution) {
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < n; i++) {
+        uint64_t state = seed + (uint64_t)(first + i) * 0x9E3779B97F4A7C15ULL;
+        uint64_t r = splitmix64(&state);
+        switch (distribution) {
+        case SKEWED: {
+            int c = (int)(r % 1000);
+            keys[i] = c * c * c / 1000; // cubes crowd towards 0
+            break;
+        }
+        case WIDE: keys[i] = (int)(uint32_t)r; break;
+        case DUP: keys[i] = (int)(r % 16); break;
+        default: keys[i] = (int)(r % 1000000); // random numbers between 0 and 999999
+        }
+    }
+}
+
+// Keys first..first+n of a file of native ints, sorted: the file is read in READ_CHUNK key chunks and every
+// chunk is sorted while the next one is being read, then the sorted chunks are merged
+// keys and tmp hold n keys each, the result is in the one returned
+int *read_sorted(MPI_File file, long first, int n, int *keys, int *tmp) {
+    int chunks = (n + READ_CHUNK - 1) / READ_CHUNK;
+    struct run *runs = (struct run *)malloc((chunks + 1) * sizeof(struct run));
+    MPI_Request pending = MPI_REQUEST_NULL;
+    if (chunks > 0) {
+        MPI_File_iread_at(file, first * sizeof(int), keys, n < READ_CHUNK ? n : READ_CHUNK, MPI_INT, &pending);
+    }
+    for (int c = 0; c < chunks; c++) {
+        int at = c * READ_CHUNK, len = n - at < READ_CHUNK ? n - at : READ_CHUNK;
+        MPI_Wait(&pending, MPI_STATUS_IGNORE);
+        if (c + 1 < chunks) {
+            int next = at + READ_CHUNK;
+            MPI_File_iread_at(file, (first + next) * sizeof(int), keys + next, n - next < READ_CHUNK ? n - next : READ_CHUNK,
+                              MPI_INT, &pending);
+        }
+        int *sorted = radix_sort(keys + at, tmp + at, len);
+        if (sorted != keys + at) memcpy(keys + at, sorted, len * sizeof(int));
+        runs[c].keys = keys + at;
+        runs[c].n = len;
+    }
+    int *result = keys;
+    if (chunks > 1) {
+        parallel_merge(runs, chunks, tmp);
+        result = tmp;
+    }
+    free(runs);
+    return result;
+}
+
+// A key together with its position in the input, so that even equal keys can be told apart
+// and a run of duplicates can be split between ranks; the sign bit is flipped so that unsigned order is int order
+uint64_t tagged_key(int key, int position) {
+    return (uint64_t)((uint32_t)key ^ 0x80000000u) << 32 | (uint32_t)position;
+}
+
+// All ranks get all ranks' samples, and every (OVERSAMPLE * size)th of the sorted samples is a splitter
+// splitters gets tree_size - 1 entries, the ones past the size - 1 real splitters are larger than any key
+void splitters_from_samples(const uint64_t *local_samples, int size, uint64_t *splitters, int tree_size) {
+    int samples = OVERSAMPLE * size;
+    uint64_t *all_samples = (uint64_t *)malloc((long)samples * size * sizeof(uint64_t));
+    MPI_Allgather(local_samples, samples, MPI_UINT64_T, all_samples, samples, MPI_UINT64_T, MPI_COMM_WORLD);
+    qsort(all_samples, (long)samples * size, sizeof(uint64_t), compare_u64);
+    for (int i = 0; i < tree_size - 1; i++) {
+        splitters[i] = i < size - 1 ? all_samples[(long)(i + 1) * samples] : UINT64_MAX;
+    }
+    free(all_samples);
+}
+
+// Regular sampling: every rank takes OVERSAMPLE * size evenly spaced keys of its sorted data
+void choose_splitters(const int *sorted, int n, int first_position, int size, uint64_t *splitters, int tree_size) {
+    int samples = OVERSAMPLE * size;
+    uint64_t *local_samples = (uint64_t *)malloc(samples * sizeof(uint64_t));
+    for (int i = 0; i < samples; i++) {
+        int index = (int)(((2L * i + 1) * n) / (2L * samples));
+        local_samples[i] = n > 0 ? tagged_key(sorted[index], first_position + index) : UINT64_MAX;
+    }
+    splitters_from_samples(local_samples, size, splitters, tree_size);
+    free(local_samples);
+}
+
+// The bucket of a tagged key is the number of splitters below it, found by a binary search without branches
+// over the splitters padded to tree_size - 1 (a power of two minus one)
+static inline int find_bucket(uint64_t key, const uint64_t *splitters, int tree_size) {
+    int pos = 0;
+    for (int step = tree_size / 2; step > 0; step /= 2) {
+        pos += (splitters[pos + step - 1] < key) * step;
+    }
+    return pos;
 }
 
 // Serial bucket sort for comparison
@@ -14,31 +303,402 @@ void serial_bucket_sort(int *data, int N) {
     qsort(data, N, sizeof(int), compare);
 }
 
-void main(int argc, char** argv) {
+// pread/pwrite of n keys at key offset in a spill file, they can transfer less than asked for
+// a spill file that cannot be read or written leaves nothing to go on with, so the whole job stops
+void read_keys(int fd, int *keys, long n, long offset) {
+    char *buf = (char *)keys;
+    long len = n * sizeof(int), at = offset * sizeof(int);
+    while (len > 0) {
+        ssize_t got = pread(fd, buf, len, at);
+        if (got <= 0) {
+            perror("Reading a spill file");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        buf += got;
+        len -= got;
+        at += got;
+    }
+}
+
+void write_keys(int fd, const int *keys, long n, long offset) {
+    const char *buf = (const char *)keys;
+    long len = n * sizeof(int), at = offset * sizeof(int);
+    while (len > 0) {
+        ssize_t written = pwrite(fd, buf, len, at);
+        if (written <= 0) {
+            perror("Writing a spill file");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        buf += written;
+        len -= written;
+        at += written;
+    }
+}
+
+// An unnamed spill file under $TMPDIR (or /tmp), it is unlinked right away so it goes when the rank does
+int open_spill(void) {
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bucketsort-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    unlink(path);
+    return fd;
+}
+
+// Number of keys of a sorted spilled run (keys n, first key at offset, tagged from position first_position on)
+// whose tagged keys are <= splitter, by a binary search that reads one key per step
+long count_on_disk(int fd, long offset, long n, long first_position, int shift, uint64_t splitter) {
+    long lo = 0, hi = n;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        int key;
+        read_keys(fd, &key, 1, offset + mid);
+        if (tagged_key(key, (int)((first_position + mid) >> shift)) <= splitter) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Distributed check of a sorted result that stays spread over the ranks: every rank's keys are in order, its first
+// key is not below the last key of any rank before it, and as many keys with the same sum come out as went in
+int verify_distributed(long in_n, uint64_t in_sum, long out_n, uint64_t out_sum, int first_key, int last_key, int in_order) {
+    int rank, last = out_n > 0 ? last_key : INT32_MIN, before = INT32_MIN;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Exscan(&last, &before, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (rank == 0) before = INT32_MIN; // Exscan leaves rank 0's result undefined
+    int ok = in_order && (out_n == 0 || first_key >= before);
+    uint64_t totals[4] = {(uint64_t)in_n, in_sum, (uint64_t)out_n, out_sum};
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, totals, 4, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    return ok && totals[0] == totals[2] && totals[1] == totals[3];
+}
+
+// Sum of the keys as unsigned, wrapping, so the output can be checked against the input without keeping either
+uint64_t key_sum(const int *keys, long n) {
+    uint64_t sum = 0;
+    #pragma omp parallel for reduction(+:sum)
+    for (long i = 0; i < n; i++) {
+        sum += (uint32_t)keys[i];
+    }
+    return sum;
+}
+
+// Out-of-core sort of a file of native int keys into another one, using about budget_keys keys of memory per rank:
+// 1. every rank reads its share of the file in runs of half the budget, sorts them and spills them to a temp file
+// 2. splitters come from regular samples of all runs, and the bucket bounds of every run by binary search on disk
+// 3. the buckets go out in rounds that move at most a third of the budget to and from each rank, every round's
+//    pieces are merged on arrival and spilled again as one sorted run
+// 4. every rank merges its rounds a block at a time straight into its part of the output file
+int external_sort(const char *input, const char *output, long budget_keys) {
     int rank, size;
-    MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_File in, out;
+    if (MPI_File_open(MPI_COMM_WORLD, input, MPI_MODE_RDONLY, MPI_INFO_NULL, &in) != MPI_SUCCESS) {
+        if (rank == 0) printf("Could not open %s\n", input);
+        return 1;
+    }
+    if (MPI_File_open(MPI_COMM_WORLD, output, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &out) != MPI_SUCCESS) {
+        if (rank == 0) printf("Could not open %s\n", output);
+        MPI_File_close(&in);
+        return 1;
+    }
+    MPI_Offset bytes;
+    MPI_File_get_size(in, &bytes);
+    long N = bytes / sizeof(int);
+    MPI_File_set_size(out, N * sizeof(int));
+    double start = MPI_Wtime();
+
+    // 1. Sorted runs. Positions past 2^31 keys are tagged coarser, so the tags still grow along every run
+    long first = N * rank / size, local_n = N * (rank + 1) / size - first;
+    int shift = 0;
+    while ((N >> shift) > INT32_MAX) shift++;
+    long run_keys = budget_keys / 2;
+    if (run_keys > (1 << 28)) run_keys = 1 << 28; // MPI counts are ints
+    if (run_keys < 1) run_keys = 1;
+    int runs = (int)((local_n + run_keys - 1) / run_keys);
+    int samples = OVERSAMPLE * size;
+    int *keys = (int *)malloc(run_keys * sizeof(int));
+    int *spare = (int *)malloc(run_keys * sizeof(int));
+    uint64_t *run_samples = (uint64_t *)malloc(((long)runs * samples + 1) * sizeof(uint64_t));
+    int spill = open_spill();
+    uint64_t in_sum = 0;
+    for (int r = 0; r < runs; r++) {
+        long n = local_n - r * run_keys < run_keys ? local_n - r * run_keys : run_keys;
+        MPI_File_read_at(in, (first + r * run_keys) * sizeof(int), keys, (int)n, MPI_INT, MPI_STATUS_IGNORE);
+        in_sum += key_sum(keys, n);
+        int *sorted = radix_sort(keys, spare, (int)n);
+        spare = sorted == keys ? spare : keys;
+        keys = sorted;
+        for (int i = 0; i < samples; i++) {
+            long index = ((2L * i + 1) * n) / (2L * samples);
+            run_samples[(long)r * samples + i] = tagged_key(keys[index], (int)((first + r * run_keys + index) >> shift));
+        }
+        write_keys(spill, keys, n, r * run_keys);
+    }
+    MPI_File_close(&in);
+    free(keys);
+    free(spare);
+
+    // 2. The runs' samples are sampled again down to one rank's share, then it is the same as in memory
+    int tree_size = 1;
+    while (tree_size < size) tree_size *= 2;
+    uint64_t *splitters = (uint64_t *)malloc(tree_size * sizeof(uint64_t));
+    uint64_t *local_samples = (uint64_t *)malloc(samples * sizeof(uint64_t));
+    qsort(run_samples, (long)runs * samples, sizeof(uint64_t), compare_u64);
+    for (int i = 0; i < samples; i++) {
+        local_samples[i] = runs > 0 ? run_samples[(long)i * runs + runs / 2] : UINT64_MAX;
+    }
+    splitters_from_samples(local_samples, size, splitters, tree_size);
+    free(run_samples);
+    free(local_samples);
+
+    // pieces[d * runs + r] keys of run r go to rank d, they start at piece_start[d * runs + r] in the spill file
+    int *pieces = (int *)malloc(((long)size * runs + 1) * sizeof(int));
+    long *piece_start = (long *)malloc(((long)size * runs + 1) * sizeof(long));
+    for (int r = 0; r < runs; r++) {
+        long n = local_n - r * run_keys < run_keys ? local_n - r * run_keys : run_keys;
+        long below = 0;
+        for (int d = 0; d < size; d++) {
+            long upto = d < size - 1 ? count_on_disk(spill, r * run_keys, n, first + r * run_keys, shift, splitters[d]) : n;
+            if (upto < below) upto = below;
+            piece_start[(long)d * runs + r] = r * run_keys + below;
+            pieces[(long)d * runs + r] = (int)(upto - below);
+            below = upto;
+        }
+    }
+    free(splitters);
+    double runs_time = MPI_Wtime() - start;
+
+    // Every rank learns the piece sizes of all runs sent to it, which is all it needs to cut up what arrives
+    int *runs_of = (int *)malloc(size * sizeof(int));
+    int *counts = (int *)malloc(size * sizeof(int)), *displs = (int *)malloc(size * sizeof(int));
+    int *in_counts = (int *)malloc(size * sizeof(int)), *in_displs = (int *)malloc(size * sizeof(int));
+    MPI_Allgather(&runs, 1, MPI_INT, runs_of, 1, MPI_INT, MPI_COMM_WORLD);
+    long all_runs = 0;
+    for (int i = 0; i < size; i++) {
+        counts[i] = runs;
+        displs[i] = i * runs;
+        in_counts[i] = runs_of[i];
+        in_displs[i] = (int)all_runs;
+        all_runs += runs_of[i];
+    }
+    int *pieces_in = (int *)malloc((all_runs + 1) * sizeof(int));
+    MPI_Alltoallv(pieces, counts, displs, MPI_INT, pieces_in, in_counts, in_displs, MPI_INT, MPI_COMM_WORLD);
 
-    int N = 1000000; // Total number of elements (increased for better timing)
-    int *data = NULL;
-    int *sorted_serial = NULL;
-    double serial_start, serial_end, parallel_start, parallel_end;
-    double serial_time, parallel_time, speedup;
+    // 3. Rounds: every rank sends at most quota keys to every rank per round
+    long *out_total = (long *)calloc(size, sizeof(long)), *in_total = (long *)calloc(size, sizeof(long));
+    long most = 0;
+    for (int i = 0; i < size; i++) {
+        for (int r = 0; r < runs; r++) out_total[i] += pieces[(long)i * runs + r];
+        for (int r = 0; r < runs_of[i]; r++) in_total[i] += pieces_in[in_displs[i] + r];
+        if (out_total[i] > most) most = out_total[i];
+    }
+    long round_keys = budget_keys / 3 < (1 << 28) ? budget_keys / 3 : 1 << 28;
+    int quota = round_keys / size > 0 ? (int)(round_keys / size) : 1;
+    long rounds = (most + quota - 1) / quota;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    int *sendbuf = (int *)malloc((long)quota * size * sizeof(int));
+    int *recvbuf = (int *)malloc((long)quota * size * sizeof(int));
+    int *merged = (int *)malloc((long)quota * size * sizeof(int));
+    struct run *parts = (struct run *)malloc((all_runs + rounds + 1) * sizeof(struct run));
+    long *round_n = (long *)malloc((rounds + 1) * sizeof(long));
+    int rounds_spill = open_spill();
+    long local_total = 0;
+    for (long t = 0; t < rounds; t++) {
+        long w0 = t * quota, w1 = w0 + quota;
+        // keys w0..w1 of the stream to rank d are the run pieces to d one after the other, cut to that window
+        for (int d = 0; d < size; d++) {
+            long at = 0;
+            for (int r = 0; r < runs; r++) {
+                long n = pieces[(long)d * runs + r];
+                long lo = at > w0 ? at : w0, hi = at + n < w1 ? at + n : w1;
+                if (lo < hi) read_keys(spill, sendbuf + (long)d * quota + (lo - w0), hi - lo, piece_start[(long)d * runs + r] + (lo - at));
+                at += n;
+            }
+            counts[d] = out_total[d] > w0 ? (int)((out_total[d] < w1 ? out_total[d] : w1) - w0) : 0;
+            displs[d] = d * quota;
+            in_counts[d] = in_total[d] > w0 ? (int)((in_total[d] < w1 ? in_total[d] : w1) - w0) : 0;
+            in_displs[d] = d * quota;
+        }
+        MPI_Alltoallv(sendbuf, counts, displs, MPI_INT, recvbuf, in_counts, in_displs, MPI_INT, MPI_COMM_WORLD);
+
+        // the same cut on the receiving side gives the sorted pieces that arrived
+        int k = 0;
+        long n = 0, in_runs = 0;
+        for (int s = 0; s < size; s++) {
+            long at = 0;
+            for (int r = 0; r < runs_of[s]; r++) {
+                long len = pieces_in[in_runs + r];
+                long lo = at > w0 ? at : w0, hi = at + len < w1 ? at + len : w1;
+                if (lo < hi) {
+                    parts[k].keys = recvbuf + in_displs[s] + (lo - w0);
+                    parts[k++].n = hi - lo;
+                    n += hi - lo;
+                }
+                at += len;
+            }
+            in_runs += runs_of[s];
+        }
+        parallel_merge(parts, k, merged);
+        write_keys(rounds_spill, merged, n, local_total);
+        round_n[t] = n;
+        local_total += n;
+    }
+    close(spill);
+    free(sendbuf);
+    free(recvbuf);
+    free(merged);
+    free(pieces);
+    free(piece_start);
+    free(pieces_in);
+    free(out_total);
+    free(in_total);
+    double exchange_time = MPI_Wtime() - start - runs_time;
+
+    // 4. Streaming merge of the rounds: keys up to the smallest last buffered key of all rounds with keys left on disk
+    // can all go out, the round that has it empties its buffer, and the buffers are topped up for the next block
+    long out_first = 0;
+    MPI_Exscan(&local_total, &out_first, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) out_first = 0;
+    long block = budget_keys / 2 / (rounds > 0 ? rounds : 1);
+    if (block < 1) block = 1;
+    if (block > (1 << 28) / (rounds > 0 ? rounds : 1)) block = (1 << 28) / (rounds > 0 ? rounds : 1);
+    int *buffers = (int *)malloc((block * rounds + 1) * sizeof(int));
+    int *block_out = (int *)malloc((block * rounds + 1) * sizeof(int));
+    long *have = (long *)calloc(rounds + 1, sizeof(long)); // keys in round t's buffer
+    long *next = (long *)malloc((rounds + 1) * sizeof(long)); // where its next keys are in the spill file
+    long *left = (long *)malloc((rounds + 1) * sizeof(long)); // and how many are still there
+    for (long t = 0, at = 0; t < rounds; t++) {
+        next[t] = at;
+        left[t] = round_n[t];
+        at += round_n[t];
+    }
+    long written = 0;
+    uint64_t out_sum = 0;
+    int in_order = 1, first_key = 0, last_key = 0;
+    while (written < local_total) {
+        int64_t bound = INT64_MAX;
+        for (long t = 0; t < rounds; t++) {
+            int *buf = buffers + t * block;
+            long n = block - have[t] < left[t] ? block - have[t] : left[t];
+            read_keys(rounds_spill, buf + have[t], n, next[t]);
+            have[t] += n;
+            next[t] += n;
+            left[t] -= n;
+            if (left[t] > 0 && buf[have[t] - 1] < bound) bound = buf[have[t] - 1];
+        }
+        long n = 0;
+        for (long t = 0; t < rounds; t++) {
+            parts[t].keys = buffers + t * block;
+            parts[t].n = bound == INT64_MAX ? have[t] : upper_bound(parts[t].keys, have[t], bound);
+            n += parts[t].n;
+        }
+        parallel_merge(parts, (int)rounds, block_out);
 
-    // Allocate memory and initialize data on root
+        if (written == 0) first_key = block_out[0];
+        else in_order &= last_key <= block_out[0];
+        #pragma omp parallel for reduction(&:in_order)
+        for (long i = 1; i < n; i++) {
+            in_order &= block_out[i - 1] <= block_out[i];
+        }
+        last_key = block_out[n - 1];
+        out_sum += key_sum(block_out, n);
+        MPI_File_write_at(out, (out_first + written) * sizeof(int), block_out, (int)n, MPI_INT, MPI_STATUS_IGNORE);
+        written += n;
+        for (long t = 0; t < rounds; t++) {
+            memmove(buffers + t * block, buffers + t * block + parts[t].n, (have[t] - parts[t].n) * sizeof(int));
+            have[t] -= parts[t].n;
+        }
+    }
+    MPI_File_close(&out);
+    close(rounds_spill);
+    double merge_time = MPI_Wtime() - start - runs_time - exchange_time;
+    int correct = verify_distributed(local_n, in_sum, local_total, out_sum, first_key, last_key, in_order);
+
+    // the slowest rank's times, and its largest share of the output
+    double times[3] = {runs_time, exchange_time, merge_time}, slowest[3];
+    long largest;
+    MPI_Reduce(times, slowest, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local_total, &largest, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
     if (rank == 0) {
-        data = (int *)malloc(N * sizeof(int));
-        sorted_serial = (int *)malloc(N * sizeof(int));
-        srand(time(0));
-        for (int i = 0; i < N; i++) {
-            data[i] = rand() % 1000000; // random numbers between 0 and 999999
+        double total_time = slowest[0] + slowest[1] + slowest[2];
+        printf("External sort of %ld keys with a budget of %ld keys per rank: %d runs on rank 0, %ld exchange rounds\n", N, budget_keys, runs, rounds);
+        printf("Runs %f s, exchange %f s, merge %f s, total %f seconds (%.1f MB/s)\n", slowest[0], slowest[1], slowest[2], total_time,
+               N * sizeof(int) / total_time / 1e6);
+        printf("Largest bucket: %ld keys, %.2f%% over N/p\n", largest, N > 0 ? 100.0 * largest / ((double)N / size) - 100.0 : 0.0);
+        if (correct) {
+            printf("Verification: SUCCESS. %s is sorted and holds the keys of %s.\n", output, input);
+        } else {
+            printf("Verification: FAILURE. %s is not a sorted copy of %s.\n", output, input);
         }
+    }
+    free(buffers);
+    free(block_out);
+    free(have);
+    free(next);
+    free(left);
+    free(round_n);
+    free(parts);
+    free(runs_of);
+    free(counts);
+    free(displs);
+    free(in_counts);
+    free(in_displs);
+    return correct ? 0 : 1;
+}
 
-        // Copy data for serial sort
-        for (int i = 0; i < N; i++) {
-            sorted_serial[i] = data[i];
+// usage: mpirun -np P ./out [N] [distribution] [output]
+//        mpirun -np P ./out file input [output]
+//        mpirun -np P ./out external input output [budget_mb]
+// distribution is uniform (default, 0..999999), skewed (most keys small), wide (the whole int range) or dup (16 values),
+// the sorted keys stay distributed and every rank writes its part of output (default sorted.bin, native ints)
+// file sorts a file of native ints that fits in memory, every rank reads its own part of it
+// external sorts a file of native ints that does not have to fit in memory, with budget_mb (default 256) MB per rank
+int main(int argc, char** argv) {
+    int rank, size;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc > 3 && strcmp(argv[1], "external") == 0) {
+        double budget_mb = argc > 4 ? atof(argv[4]) : 256;
+        int status = external_sort(argv[2], argv[3], (long)(budget_mb * (1 << 20) / sizeof(int)));
+        MPI_Finalize();
+        return status;
+    }
+
+    // The input is generated from a seed all ranks share, or read from a file, by every rank for itself
+    int from_file = argc > 2 && strcmp(argv[1], "file") == 0;
+    int N = argc > 1 && !from_file ? atoi(argv[1]) : 1000000; // Total number of elements (increased for better timing)
+    enum distribution distribution = parse_distribution(argc > 2 && !from_file ? argv[2] : "uniform");
+    const char *output = argc > 3 ? argv[3] : "sorted.bin";
+    uint64_t seed = (uint64_t)time(0);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    MPI_File input;
+    if (from_file) {
+        if (MPI_File_open(MPI_COMM_WORLD, argv[2], MPI_MODE_RDONLY, MPI_INFO_NULL, &input) != MPI_SUCCESS) {
+            if (rank == 0) printf("Could not open %s\n", argv[2]);
+            MPI_Finalize();
+            return 1;
         }
+        MPI_Offset bytes;
+        MPI_File_get_size(input, &bytes);
+        N = (int)(bytes / sizeof(int));
+    }
+    int *sorted_serial = NULL;
+    double serial_start, serial_end, parallel_start, parallel_end;
+    double serial_time = 0, parallel_time, speedup;
+
+    // The serial baseline needs all keys in one place, root makes them again for it (not for a file)
+    if (rank == 0 && !from_file) {
+        sorted_serial = (int *)malloc(N * sizeof(int));
+        generate_keys(sorted_serial, 0, N, seed, distribution);
 
         // Serial Sort Timing
         serial_start = MPI_Wtime();
@@ -49,39 +709,53 @@ void main(int argc, char** argv) {
         printf("Serial sort completed in %f seconds.\n", serial_time);
     }
 
-    // Parallel Sort Timing Start
+    // Parallel Sort Timing Start, the input is part of it since no rank waits for root to hand it out
     MPI_Barrier(MPI_COMM_WORLD); // Ensure all processes start together
     parallel_start = MPI_Wtime();
-    
-    // Broadcast N to all processes in case it's needed
-    MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    int chunk_size = N / size;
-    int *local_data = (int *)malloc(chunk_size * sizeof(int));
-
-    // Scatter data to all processes
-    MPI_Scatter(data, chunk_size, MPI_INT, local_data, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // Each process sorts its local data
-    qsort(local_data, chunk_size, sizeof(int), compare);
-
-    // Prepare buckets
+    // The first N % size ranks get one element more, so nothing is left over
     int *sendcounts = (int *)calloc(size, sizeof(int));  // counts of numbers to send to each process
     int *sdispls = (int *)calloc(size, sizeof(int));     // displacements of numbers to send to each process
     int *recvcounts = (int *)calloc(size, sizeof(int));  // counts of numbers to receive from each process
     int *rdispls = (int *)calloc(size, sizeof(int));     // displacements of numbers to receive from each process
-
-    int **buckets = (int **)malloc(size * sizeof(int *));
     for (int i = 0; i < size; i++) {
-        buckets[i] = (int *)malloc(chunk_size * sizeof(int));
-        sendcounts[i] = 0;
+        sendcounts[i] = N / size + (i < N % size);
+        sdispls[i] = i > 0 ? sdispls[i - 1] + sendcounts[i - 1] : 0;
     }
-
-    // Distribute local data into appropriate buckets based on value range
+    int chunk_size = sendcounts[rank];
+    int first_position = sdispls[rank]; // where the rank's keys start in the input
+    // Two buffers of about the local size are all a rank needs: the radix sort sorts between them,
+    // the sorted keys are sent straight from the one they end up in, and the other one receives
+    int *local_data = (int *)malloc(chunk_size * sizeof(int));
+    int *spare = (int *)malloc(chunk_size * sizeof(int));
+
+    // Each process makes or reads its part of the input and sorts it
+    double local_sort_start = MPI_Wtime();
+    int *sorted;
+    if (from_file) {
+        sorted = read_sorted(input, first_position, chunk_size, local_data, spare);
+        MPI_File_close(&input);
+    }
+    else {
+        generate_keys(local_data, first_position, chunk_size, seed, distribution);
+        sorted = radix_sort(local_data, spare, chunk_size);
+    }
+    spare = sorted == local_data ? spare : local_data;
+    double local_sort_time = MPI_Wtime() - local_sort_start;
+    uint64_t in_sum = key_sum(sorted, chunk_size); // for the verification, the order does not change the sum
+
+    // Splitters from the data itself, so the buckets come out even whatever the keys look like
+    int tree_size = 1;
+    while (tree_size < size) tree_size *= 2;
+    uint64_t *splitters = (uint64_t *)malloc(tree_size * sizeof(uint64_t));
+    choose_splitters(sorted, chunk_size, first_position, size, splitters, tree_size);
+
+    // Count the keys of every bucket, the keys are sorted so each bucket is already one run of them
+    // and the sorted keys themselves are the send buffer, nothing is copied into buckets
+    memset(sendcounts, 0, size * sizeof(int));
+    #pragma omp parallel for reduction(+:sendcounts[:size])
     for (int i = 0; i < chunk_size; i++) {
-        int target_proc = (int)(((double)local_data[i] / 1000000) * size);
-        if (target_proc >= size) target_proc = size - 1; // Handle max value
-        buckets[target_proc][sendcounts[target_proc]++] = local_data[i];
+        sendcounts[find_bucket(tagged_key(sorted[i], first_position + i), splitters, tree_size)]++;
     }
 
     // Calculate send displacements
@@ -90,16 +764,6 @@ void main(int argc, char** argv) {
         sdispls[i] = sdispls[i - 1] + sendcounts[i - 1];
     }
 
-    int total_send = sdispls[size - 1] + sendcounts[size - 1];
-    int *sendbuf = (int *)malloc(total_send * sizeof(int));
-
-    // Pack sendbuf with values from buckets
-    for (int i = 0; i < size; i++) {
-        for (int j = 0; j < sendcounts[i]; j++) {
-            sendbuf[sdispls[i] + j] = buckets[i][j];
-        }
-    }
-
     // Exchange the counts of data each process will receive
     MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, MPI_COMM_WORLD);
 
@@ -110,79 +774,136 @@ void main(int argc, char** argv) {
     }
 
     int total_recv = rdispls[size - 1] + recvcounts[size - 1];
-    int *recvbuf = (int *)malloc(total_recv * sizeof(int));
-
-    // All-to-all exchange of the data
-    MPI_Alltoallv(sendbuf, sendcounts, sdispls, MPI_INT, recvbuf, recvcounts, rdispls, MPI_INT, MPI_COMM_WORLD);
-
-    // Sort the received data
-    qsort(recvbuf, total_recv, sizeof(int), compare);
-
-    // Gather the sizes of sorted data from all processes to root
-    MPI_Gather(&total_recv, 1, MPI_INT, recvcounts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int *recvbuf = (int *)realloc(spare, (total_recv > 0 ? total_recv : 1) * sizeof(int));
 
-    // Calculate displacements for Gatherv
-    if (rank == 0) {
-        rdispls[0] = 0;
-        for (int i = 1; i < size; i++) {
-            rdispls[i] = rdispls[i - 1] + recvcounts[i - 1];
+    // Exchange the data with a receive per source instead of one Alltoallv, what arrives are sorted runs,
+    // and the runs of every MERGE_GROUP neighbouring sources are merged as soon as the group is complete
+    MPI_Request *recv_requests = (MPI_Request *)malloc(size * sizeof(MPI_Request));
+    MPI_Request *send_requests = (MPI_Request *)malloc(size * sizeof(MPI_Request));
+    for (int i = 0; i < size; i++) {
+        recv_requests[i] = send_requests[i] = MPI_REQUEST_NULL;
+        if (i != rank) {
+            MPI_Irecv(recvbuf + rdispls[i], recvcounts[i], MPI_INT, i, 0, MPI_COMM_WORLD, &recv_requests[i]);
         }
     }
-
-    // Allocate memory for the sorted parallel data on root
-    int *sorted_parallel = NULL;
-    if (rank == 0) {
-        sorted_parallel = (int *)malloc(N * sizeof(int));
+    for (int i = 0; i < size; i++) {
+        if (i != rank) {
+            MPI_Isend(sorted + sdispls[i], sendcounts[i], MPI_INT, i, 0, MPI_COMM_WORLD, &send_requests[i]);
+        }
+    }
+    memcpy(recvbuf + rdispls[rank], sorted + sdispls[rank], sendcounts[rank] * sizeof(int));
+
+    // The send buffer becomes the merge output once everything in it is on its way
+    MPI_Waitall(size, send_requests, MPI_STATUSES_IGNORE);
+    spare = (int *)realloc(sorted, (total_recv > 0 ? total_recv : 1) * sizeof(int));
+
+    int groups = (size + MERGE_GROUP - 1) / MERGE_GROUP;
+    int *arrived = (int *)calloc(groups, sizeof(int));
+    struct run *runs = (struct run *)malloc((size > groups ? size : groups) * sizeof(struct run));
+    int merged_groups = 0;
+    arrived[rank / MERGE_GROUP]++;
+    while (merged_groups < groups) {
+        for (int g = 0; g < groups; g++) {
+            int first = g * MERGE_GROUP, count = size - first < MERGE_GROUP ? size - first : MERGE_GROUP;
+            if (arrived[g] == count) {
+                for (int i = 0; i < count; i++) {
+                    runs[i].keys = recvbuf + rdispls[first + i];
+                    runs[i].n = recvcounts[first + i];
+                }
+                parallel_merge(runs, count, spare + rdispls[first]);
+                arrived[g] = -1;
+                merged_groups++;
+            }
+        }
+        if (merged_groups < groups) {
+            int source;
+            MPI_Waitany(size, recv_requests, &source, MPI_STATUS_IGNORE);
+            arrived[source / MERGE_GROUP]++;
+        }
     }
 
-    // Gather all sorted data to root
-    MPI_Gatherv(recvbuf, total_recv, MPI_INT, sorted_parallel, recvcounts, rdispls, MPI_INT, 0, MPI_COMM_WORLD);
+    // One more merge of the merged groups when there is more than one
+    int *merged = spare;
+    if (groups > 1) {
+        for (int g = 0; g < groups; g++) {
+            int first = g * MERGE_GROUP, last = (g + 1) * MERGE_GROUP < size ? (g + 1) * MERGE_GROUP : size;
+            runs[g].keys = spare + rdispls[first];
+            runs[g].n = rdispls[last - 1] + recvcounts[last - 1] - rdispls[first];
+        }
+        parallel_merge(runs, groups, recvbuf);
+        merged = recvbuf;
+    }
+    spare = merged == spare ? recvbuf : spare;
+    recvbuf = merged;
+    free(recv_requests);
+    free(send_requests);
+    free(arrived);
+    free(runs);
+
+    // The result stays where it is, a rank's place in it is the number of keys on the ranks before it
+    long out_first = 0, local_total = total_recv;
+    MPI_Exscan(&local_total, &out_first, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) out_first = 0; // Exscan leaves rank 0's result undefined
 
     // Parallel Sort Timing End
     MPI_Barrier(MPI_COMM_WORLD); // Ensure all processes have finished
     parallel_end = MPI_Wtime();
     parallel_time = parallel_end - parallel_start;
 
+    // Every rank writes its slice into the one output file, collectively so MPI-IO can aggregate the writes
+    double write_start = MPI_Wtime();
+    MPI_File file;
+    int wrote = MPI_File_open(MPI_COMM_WORLD, output, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) == MPI_SUCCESS;
+    if (wrote) {
+        MPI_File_set_size(file, (MPI_Offset)N * sizeof(int));
+        MPI_File_write_at_all(file, out_first * sizeof(int), recvbuf, total_recv, MPI_INT, MPI_STATUS_IGNORE);
+        MPI_File_close(&file);
+    }
+    double write_time = MPI_Wtime() - write_start;
+
+    // Verify without collecting anything: local order, the boundaries between ranks, and the key counts and sums
+    int in_order = 1;
+    #pragma omp parallel for reduction(&:in_order)
+    for (int i = 1; i < total_recv; i++) {
+        in_order &= recvbuf[i - 1] <= recvbuf[i];
+    }
+    int correct = verify_distributed(chunk_size, in_sum, total_recv, key_sum(recvbuf, total_recv),
+                                     total_recv > 0 ? recvbuf[0] : 0, total_recv > 0 ? recvbuf[total_recv - 1] : 0, in_order);
+    int largest;
+    MPI_Reduce(&total_recv, &largest, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+
     if (rank == 0) {
         printf("Parallel sort completed in %f seconds.\n", parallel_time);
-
-        // Verify if the serial and parallel sorted arrays are the same
-        int correct = 1;
-        for (int i = 0; i < N; i++) {
-            if (sorted_serial[i] != sorted_parallel[i]) {
-                correct = 0;
-                printf("Mismatch at index %d: serial=%d, parallel=%d\n", i, sorted_serial[i], sorted_parallel[i]);
-                break;
-            }
+        printf("Local input and sort on rank 0: %f seconds for %d keys with %d threads.\n", local_sort_time, chunk_size, omp_get_max_threads());
+        printf("Largest bucket: %d keys, %.2f%% over N/p\n", largest, 100.0 * largest / ((double)N / size) - 100.0);
+        if (wrote) {
+            printf("Wrote %s in %f seconds (%.1f MB/s).\n", output, write_time, N * sizeof(int) / write_time / 1e6);
+        } else {
+            printf("Could not open %s\n", output);
         }
         if (correct) {
-            printf("Verification: SUCCESS. Serial and Parallel sorted arrays match.\n");
+            printf("Verification: SUCCESS. Every rank's keys are in order, follow the ranks before it and add up to the input.\n");
         } else {
-            printf("Verification: FAILURE. Sorted arrays do not match.\n");
+            printf("Verification: FAILURE. The distributed result is not sorted.\n");
         }
 
         // Calculate speedup
-        speedup = serial_time / parallel_time;
-        printf("Speedup: %f\n", speedup);
+        if (!from_file) {
+            speedup = serial_time / parallel_time;
+            printf("Speedup: %f\n", speedup);
+        }
     }
 
     // Free allocated memory
-    free(local_data);
     free(sendcounts);
     free(recvcounts);
     free(sdispls);
     free(rdispls);
     free(recvbuf);
-    free(sendbuf);
-    for (int i = 0; i < size; i++) {
-        free(buckets[i]);
-    }
-    free(buckets);
-    if (rank == 0) {
-        free(data);
-        free(sorted_serial);
-        free(sorted_parallel);
-    }
+    free(spare);
+    free(splitters);
+    free(sorted_serial);
 
     MPI_Finalize();
+    return 0;
 }